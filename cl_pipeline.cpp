@@ -0,0 +1,514 @@
+#include <string.h>
+#include <algorithm>
+#include "AOCLUtils/aocl_utils.h"
+#include "cl_pipeline.h"
+
+using namespace aocl_utils;
+
+cl_pipeline::cl_pipeline(cl_context context, cl_device_id device, cl_program program, mode kernel_mode, int depth,
+                         int units, bool collect_stats)
+    : context(context), compute_queues(kernel_mode == FUSED && units > 1 ? units : 1), kernel_mode(kernel_mode),
+      slots(depth < 1 ? 1 : depth), profile(NULL) {
+    cl_int status;
+
+    upload_queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &status);
+    checkError(status, "Error: could not create upload queue");
+    for (size_t u = 0; u < compute_queues.size(); u++) {
+        compute_queues[u] = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &status);
+        checkError(status, "Error: could not create compute queue");
+    }
+    download_queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &status);
+    checkError(status, "Error: could not create download queue");
+    image_stats_clear(last_stats);
+
+    for (size_t n = 0; n < slots.size(); n++) {
+        slot& s = slots[n];
+        for (int i = 0; i < BUFFER_COUNT; i++) {
+            s.device[i] = NULL;
+            s.pinned[i] = NULL;
+            s.host[i] = NULL;
+            s.capacity[i] = 0;
+        }
+        for (int k = 0; k < KERNEL_COUNT; k++) {
+            s.kernels[k] = NULL;
+        }
+        for (int e = 0; e < EVENT_COUNT; e++) {
+            s.events[e] = NULL;
+        }
+        s.bound_width = s.bound_height = 0;
+        s.done = NULL;
+        s.image = -1;
+        s.stats_bands = 0;
+
+        // Names must match the kernel names in the CL file.
+        if (kernel_mode == FUSED) {
+            // The band kernel takes the same arguments plus the band rows.
+            const char* name = compute_queues.size() > 1 ? "laplacian_sharpen_band" : "laplacian_sharpen";
+            s.kernels[FUSED_KERNEL] = clCreateKernel(program, name, &status);
+            checkError(status, "Failed to create %s kernel", name);
+
+            // Without collect_stats the kernel gets a null stats pointer
+            // and skips them. Bands bind their own buffer at enqueue.
+            if (collect_stats) {
+                size_t bands = compute_queues.size() > 1 ? compute_queues.size() * BANDS_PER_UNIT : 1;
+                s.stats_device.resize(bands);
+                s.band_stats.resize(bands);
+                for (size_t u = 0; u < s.stats_device.size(); u++) {
+                    s.stats_device[u] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(image_stats), NULL,
+                                                       &status);
+                    checkError(status, "Error: could not create stats buffer");
+                }
+            }
+            if (compute_queues.size() == 1) {
+                status = clSetKernelArg(s.kernels[FUSED_KERNEL], BUFFER_COUNT + 2, sizeof(cl_mem),
+                                        collect_stats ? &s.stats_device[0] : NULL);
+                checkError(status, "Error: could not set laplacian_sharpen kernel arg 6");
+            }
+            continue;
+        }
+
+        s.kernels[GRAYSCALE_KERNEL] = clCreateKernel(program, "grayscale", &status);
+        checkError(status, "Failed to create grayscale kernel");
+
+        s.kernels[LAPLACIAN_KERNEL] = clCreateKernel(program, "laplacian", &status);
+        checkError(status, "Failed to create laplacian kernel");
+
+        s.kernels[SHARPEN_KERNEL] = clCreateKernel(program, "sharpen", &status);
+        checkError(status, "Failed to create sharpen kernel");
+    }
+
+    if (kernel_mode == FUSED) {
+        return;
+    }
+
+    // Tile size the laplacian kernel was compiled for (reqd_work_group_size).
+    size_t compiled[3];
+    status = clGetKernelWorkGroupInfo(slots[0].kernels[LAPLACIAN_KERNEL], device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE,
+                                      sizeof(compiled), compiled, NULL);
+    checkError(status, "Error: could not query laplacian work-group size");
+    laplacian_tile[0] = compiled[0] ? compiled[0] : 16;
+    laplacian_tile[1] = compiled[1] ? compiled[1] : 16;
+}
+
+cl_pipeline::~cl_pipeline() {
+    for (size_t n = 0; n < slots.size(); n++) {
+        slot& s = slots[n];
+        if (s.done) {
+            clWaitForEvents(1, &s.done);
+            clReleaseEvent(s.done);
+        }
+        for (int e = 0; e < EVENT_COUNT; e++) {
+            if (s.events[e])
+                clReleaseEvent(s.events[e]);
+        }
+        for (size_t b = 0; b < s.band_events.size(); b++) {
+            clReleaseEvent(s.band_events[b]);
+        }
+        for (int i = 0; i < BUFFER_COUNT; i++) {
+            release(s, i);
+        }
+        for (size_t u = 0; u < s.stats_device.size(); u++) {
+            clReleaseMemObject(s.stats_device[u]);
+        }
+        for (int k = 0; k < KERNEL_COUNT; k++) {
+            if (s.kernels[k])
+                clReleaseKernel(s.kernels[k]);
+        }
+    }
+    clReleaseCommandQueue(upload_queue);
+    for (size_t u = 0; u < compute_queues.size(); u++) {
+        clReleaseCommandQueue(compute_queues[u]);
+    }
+    clReleaseCommandQueue(download_queue);
+}
+
+unsigned char* cl_pipeline::input(int width, int height) {
+    finish(slots[0], NULL);
+    reserve(slots[0], width, height);
+    return slots[0].host[INPUT];
+}
+
+void cl_pipeline::run(const unsigned char* image, int width, int height) {
+    // A batch may have left other slots in flight; their results are dropped.
+    for (size_t n = 0; n < slots.size(); n++) {
+        finish(slots[n], NULL);
+    }
+    submit(slots[0], image, width, height);
+    finish(slots[0], NULL);
+}
+
+void cl_pipeline::run_direct(const unsigned char* image, int width, int height, unsigned char* grayscale,
+                             unsigned char* filtered, unsigned char* sharpened) {
+    for (size_t n = 0; n < slots.size(); n++) {
+        finish(slots[n], NULL);
+    }
+    unsigned char* outputs[3] = {grayscale, filtered, sharpened};
+    submit(slots[0], image, width, height, outputs);
+    finish(slots[0], NULL);
+}
+
+void cl_pipeline::run_batch(const cl_image* images, int count, const batch_callback& done) {
+    for (size_t n = 0; n < slots.size(); n++) {
+        finish(slots[n], NULL);
+    }
+
+    // Image i uses slot i % depth, so submitting it first retires image
+    // i - depth; everything between stays queued on the device.
+    for (int i = 0; i < count; i++) {
+        slot& s = slots[i % slots.size()];
+        finish(s, &done);
+        submit(s, images[i].pixels, images[i].width, images[i].height);
+        s.image = i;
+    }
+    for (int i = count - (int)slots.size(); i < count; i++) {
+        if (i >= 0) {
+            finish(slots[i % slots.size()], &done);
+        }
+    }
+}
+
+// Without outputs the image is staged through the slot's pinned input and the
+// results land in its pinned outputs; with them, both sides use the caller's
+// memory directly.
+void cl_pipeline::submit(slot& s, const unsigned char* image, int width, int height,
+                         unsigned char* const* outputs) {
+    cl_int status;
+    size_t pixels = (size_t)width * height;
+    cl_event uploaded, computed;
+
+    if (width > max_width()) {
+        checkError(CL_INVALID_IMAGE_SIZE, "Error: the fused kernels take frames up to %d pixels wide, not %d",
+                   max_width(), width);
+    }
+    reserve(s, width, height);
+    bind_dimensions(s, width, height);
+    if (!outputs) {
+        if (image != s.host[INPUT]) {
+            memcpy(s.host[INPUT], image, pixels * 3);
+        }
+        image = s.host[INPUT];
+        outputs = &s.host[GRAYSCALE];
+    }
+
+    status = clEnqueueWriteBuffer(upload_queue, s.device[INPUT], CL_FALSE, 0, pixels * 3, image, 0, NULL,
+                                  &uploaded);
+    checkError(status, "Error: could not copy data into device");
+    keep_event(s, UPLOAD_EVENT, uploaded);
+
+    if (kernel_mode == FUSED && compute_queues.size() > 1) {
+        enqueue_bands(s, height, uploaded, &computed);
+    } else if (kernel_mode == FUSED) {
+        status = clEnqueueTask(compute_queues[0], s.kernels[FUSED_KERNEL], 1, &uploaded, &computed);
+        checkError(status, "Error: failed to enqueue laplacian_sharpen kernel");
+        keep_event(s, FUSED_EVENT, computed);
+        s.stats_bands = (int)s.stats_device.size();
+    } else {
+        enqueue_kernels(s, width, height, uploaded, &computed);
+        keep_event(s, SHARPEN_EVENT, computed);
+    }
+
+    status = clEnqueueReadBuffer(download_queue, s.device[GRAYSCALE], CL_FALSE, 0, pixels, outputs[0],
+                                 1, &computed, event(s, DOWNLOAD_GRAYSCALE_EVENT));
+    checkError(status, "Error: could not copy grayscale data from device");
+
+    // Behind the grayscale read on the in-order queue, so after the kernels.
+    for (int b = 0; b < s.stats_bands; b++) {
+        status = clEnqueueReadBuffer(download_queue, s.stats_device[b], CL_FALSE, 0, sizeof(image_stats),
+                                     &s.band_stats[b], 0, NULL, NULL);
+        checkError(status, "Error: could not copy stats from device");
+    }
+
+    status = clEnqueueReadBuffer(download_queue, s.device[FILTERED], CL_FALSE, 0, pixels, outputs[1],
+                                 0, NULL, event(s, DOWNLOAD_FILTERED_EVENT));
+    checkError(status, "Error: could not copy filtered data from device");
+
+    status = clEnqueueReadBuffer(download_queue, s.device[SHARPENED], CL_FALSE, 0, pixels, outputs[2],
+                                 0, NULL, &s.done);
+    checkError(status, "Error: could not copy sharpened data from device");
+    keep_event(s, DOWNLOAD_SHARPENED_EVENT, s.done);
+
+    clReleaseEvent(uploaded);
+    clReleaseEvent(computed);
+
+    // Nothing waits on these queues until the slot comes round again, so
+    // make sure the commands are actually submitted.
+    clFlush(upload_queue);
+    for (size_t u = 0; u < compute_queues.size(); u++) {
+        clFlush(compute_queues[u]);
+    }
+    clFlush(download_queue);
+}
+
+void cl_pipeline::enqueue_kernels(slot& s, int width, int height, cl_event uploaded, cl_event* computed) {
+    cl_int status;
+
+    // The compute queue is in order, so only the first kernel needs to wait
+    // for the upload and only the downloads need to wait for the last kernel.
+    size_t global_work_size[2] = {(size_t)width, (size_t)height};
+    status = clEnqueueNDRangeKernel(compute_queues[0], s.kernels[GRAYSCALE_KERNEL], 2, NULL, global_work_size, NULL,
+                                    1, &uploaded, event(s, GRAYSCALE_EVENT));
+    checkError(status, "Error: failed to enqueue grayscale kernel");
+
+    // The Laplacian runs on whole tiles of its required work-group size.
+    size_t tile_work_size[2] = {
+        (global_work_size[0] + laplacian_tile[0] - 1) / laplacian_tile[0] * laplacian_tile[0],
+        (global_work_size[1] + laplacian_tile[1] - 1) / laplacian_tile[1] * laplacian_tile[1]};
+    status = clEnqueueNDRangeKernel(compute_queues[0], s.kernels[LAPLACIAN_KERNEL], 2, NULL, tile_work_size,
+                                    laplacian_tile, 0, NULL, event(s, LAPLACIAN_EVENT));
+    checkError(status, "Error: failed to enqueue laplacian kernel");
+
+    status = clEnqueueNDRangeKernel(compute_queues[0], s.kernels[SHARPEN_KERNEL], 2, NULL, global_work_size, NULL,
+                                    0, NULL, computed);
+    checkError(status, "Error: failed to enqueue sharpen kernel");
+}
+
+// BANDS_PER_UNIT bands of rows per unit, dealt round-robin to the unit
+// queues. The runtime starts the head of every queue on a free compute unit,
+// and a queue that finishes early moves on to its next band, so the load
+// evens out across units. The bands write disjoint rows of the same buffers;
+// computed fires once all of them are done.
+void cl_pipeline::enqueue_bands(slot& s, int height, cl_event uploaded, cl_event* computed) {
+    cl_int status;
+    int units = (int)compute_queues.size();
+    int count = units * BANDS_PER_UNIT;
+    int band_rows = (height + count - 1) / count;
+    std::vector<cl_event> bands;
+
+    for (int b = 0; b < count && b * band_rows < height; b++) {
+        int first_row = b * band_rows;
+        int rows = std::min(band_rows, height - first_row);
+        // Arguments are captured at enqueue, so one kernel object serves every band.
+        status = clSetKernelArg(s.kernels[FUSED_KERNEL], BUFFER_COUNT + 2, sizeof(int), &first_row);
+        checkError(status, "Error: could not set laplacian_sharpen_band kernel arg 6");
+        status = clSetKernelArg(s.kernels[FUSED_KERNEL], BUFFER_COUNT + 3, sizeof(int), &rows);
+        checkError(status, "Error: could not set laplacian_sharpen_band kernel arg 7");
+        status = clSetKernelArg(s.kernels[FUSED_KERNEL], BUFFER_COUNT + 4, sizeof(cl_mem),
+                                s.stats_device.empty() ? NULL : &s.stats_device[b]);
+        checkError(status, "Error: could not set laplacian_sharpen_band kernel arg 8");
+
+        cl_event band;
+        status = clEnqueueTask(compute_queues[b % units], s.kernels[FUSED_KERNEL], 1, &uploaded, &band);
+        checkError(status, "Error: failed to enqueue laplacian_sharpen_band kernel");
+        bands.push_back(band);
+    }
+
+    s.stats_bands = s.stats_device.empty() ? 0 : (int)bands.size();
+    status = clEnqueueMarkerWithWaitList(compute_queues[0], (cl_uint)bands.size(), &bands[0], computed);
+    checkError(status, "Error: could not join the band kernels");
+    if (profile) {
+        s.band_events = bands;
+    } else {
+        for (size_t b = 0; b < bands.size(); b++) {
+            clReleaseEvent(bands[b]);
+        }
+    }
+}
+
+void cl_pipeline::finish(slot& s, const batch_callback* done) {
+    cl_int status;
+
+    if (!s.done) {
+        return;
+    }
+    status = clWaitForEvents(1, &s.done);
+    checkError(status, "Failed to finish");
+    clReleaseEvent(s.done);
+    s.done = NULL;
+    record(s);
+
+    if (s.stats_bands) {
+        image_stats_clear(last_stats);
+        for (int b = 0; b < s.stats_bands; b++) {
+            image_stats_merge(last_stats, s.band_stats[b]);
+        }
+    }
+
+    if (done) {
+        (*done)(s.image, s.host[GRAYSCALE], s.host[FILTERED], s.host[SHARPENED]);
+    }
+}
+
+// Where to return the event of command which; NULL unless profiling.
+cl_event* cl_pipeline::event(slot& s, int which) {
+    return profile ? &s.events[which] : NULL;
+}
+
+// Holds on to an event the pipeline needs anyway, for the profile.
+void cl_pipeline::keep_event(slot& s, int which, cl_event e) {
+    if (profile) {
+        clRetainEvent(e);
+        s.events[which] = e;
+    }
+}
+
+// Adds the finished image's command times to the profile and drops its events.
+void cl_pipeline::record(slot& s) {
+    static const char* names[EVENT_COUNT] = {"upload", "grayscale", "laplacian", "sharpen", "laplacian_sharpen",
+                                              "download", "download", "download"};
+    // Bytes each command reads plus writes, per pixel.
+    static const int bytes_per_pixel[EVENT_COUNT] = {3, 3 + 1, 1 + 1, 2 + 1, 3 + 3, 1, 1, 1};
+    size_t pixels = (size_t)s.bound_width * s.bound_height;
+    double download_ms = 0;
+    bool downloaded = false;
+
+    for (int e = 0; e < EVENT_COUNT; e++) {
+        if (!s.events[e]) {
+            continue;
+        }
+        cl_ulong start = 0, end = 0;
+        clGetEventProfilingInfo(s.events[e], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+        clGetEventProfilingInfo(s.events[e], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+        clReleaseEvent(s.events[e]);
+        s.events[e] = NULL;
+        if (!profile) {
+            continue;
+        }
+
+        double ms = (end - start) * 1e-6;
+        if (e >= DOWNLOAD_GRAYSCALE_EVENT) {
+            // The three reads are one stage.
+            download_ms += ms;
+            downloaded = true;
+        } else {
+            profile->add(names[e], ms, pixels, pixels * bytes_per_pixel[e]);
+        }
+    }
+    // Bands run side by side, so the stage takes from the first start to the last end.
+    if (!s.band_events.empty()) {
+        cl_ulong first = 0, last = 0;
+        for (size_t b = 0; b < s.band_events.size(); b++) {
+            cl_ulong start = 0, end = 0;
+            clGetEventProfilingInfo(s.band_events[b], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+            clGetEventProfilingInfo(s.band_events[b], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+            clReleaseEvent(s.band_events[b]);
+            first = b == 0 || start < first ? start : first;
+            last = end > last ? end : last;
+        }
+        s.band_events.clear();
+        if (profile) {
+            profile->add(names[FUSED_EVENT], (last - first) * 1e-6, pixels, pixels * bytes_per_pixel[FUSED_EVENT]);
+        }
+    }
+    if (downloaded) {
+        profile->add(names[DOWNLOAD_SHARPENED_EVENT], download_ms, pixels,
+                     pixels * (bytes_per_pixel[DOWNLOAD_GRAYSCALE_EVENT] + bytes_per_pixel[DOWNLOAD_FILTERED_EVENT] +
+                               bytes_per_pixel[DOWNLOAD_SHARPENED_EVENT]));
+    }
+}
+
+void cl_pipeline::reserve(slot& s, int width, int height) {
+    size_t pixels = (size_t)width * height;
+    bool changed = false;
+
+    if (pixels * 3 > s.capacity[INPUT]) {
+        grow(s, INPUT, pixels * 3);
+        changed = true;
+    }
+    for (int i = GRAYSCALE; i < BUFFER_COUNT; i++) {
+        if (pixels > s.capacity[i]) {
+            grow(s, i, pixels);
+            changed = true;
+        }
+    }
+    if (changed) {
+        bind_buffers(s);
+    }
+}
+
+void cl_pipeline::grow(slot& s, int which, size_t bytes) {
+    cl_int status;
+
+    release(s, which);
+
+    cl_mem_flags flags = which == INPUT ? CL_MEM_READ_ONLY : CL_MEM_READ_WRITE;
+    s.device[which] = clCreateBuffer(context, flags, bytes, NULL, &status);
+    checkError(status, "Error: could not create device buffer");
+    s.capacity[which] = bytes;
+
+    // Host-allocated buffer mapped once for the life of the allocation; the
+    // runtime can DMA straight from it instead of staging through its own copy.
+    s.pinned[which] = clCreateBuffer(context, CL_MEM_ALLOC_HOST_PTR, bytes, NULL, &status);
+    checkError(status, "Error: could not create pinned host buffer");
+    s.host[which] = (unsigned char*)clEnqueueMapBuffer(upload_queue, s.pinned[which], CL_TRUE,
+                                                       CL_MAP_READ | CL_MAP_WRITE, 0, bytes, 0, NULL, NULL, &status);
+    checkError(status, "Error: could not map pinned host buffer");
+}
+
+void cl_pipeline::release(slot& s, int which) {
+    if (s.host[which]) {
+        clEnqueueUnmapMemObject(upload_queue, s.pinned[which], s.host[which], 0, NULL, NULL);
+        clFinish(upload_queue);
+        s.host[which] = NULL;
+    }
+    if (s.pinned[which]) {
+        clReleaseMemObject(s.pinned[which]);
+        s.pinned[which] = NULL;
+    }
+    if (s.device[which]) {
+        clReleaseMemObject(s.device[which]);
+        s.device[which] = NULL;
+    }
+    s.capacity[which] = 0;
+}
+
+void cl_pipeline::bind_buffers(slot& s) {
+    cl_int status;
+
+    if (kernel_mode == FUSED) {
+        for (int i = 0; i < BUFFER_COUNT; i++) {
+            status = clSetKernelArg(s.kernels[FUSED_KERNEL], i, sizeof(cl_mem), &s.device[i]);
+            checkError(status, "Error: could not set laplacian_sharpen kernel buffer arg");
+        }
+        return;
+    }
+
+    status = clSetKernelArg(s.kernels[GRAYSCALE_KERNEL], 0, sizeof(cl_mem), &s.device[INPUT]);
+    checkError(status, "Error: could not set grayscale kernel arg 0");
+    status = clSetKernelArg(s.kernels[GRAYSCALE_KERNEL], 1, sizeof(cl_mem), &s.device[GRAYSCALE]);
+    checkError(status, "Error: could not set grayscale kernel arg 1");
+
+    status = clSetKernelArg(s.kernels[LAPLACIAN_KERNEL], 0, sizeof(cl_mem), &s.device[GRAYSCALE]);
+    checkError(status, "Error: could not set laplacian kernel arg 0");
+    status = clSetKernelArg(s.kernels[LAPLACIAN_KERNEL], 1, sizeof(cl_mem), &s.device[FILTERED]);
+    checkError(status, "Error: could not set laplacian kernel arg 1");
+
+    status = clSetKernelArg(s.kernels[SHARPEN_KERNEL], 0, sizeof(cl_mem), &s.device[GRAYSCALE]);
+    checkError(status, "Error: could not set sharpen kernel arg 0");
+    status = clSetKernelArg(s.kernels[SHARPEN_KERNEL], 1, sizeof(cl_mem), &s.device[FILTERED]);
+    checkError(status, "Error: could not set sharpen kernel arg 1");
+    status = clSetKernelArg(s.kernels[SHARPEN_KERNEL], 2, sizeof(cl_mem), &s.device[SHARPENED]);
+    checkError(status, "Error: could not set sharpen kernel arg 2");
+}
+
+void cl_pipeline::bind_dimensions(slot& s, int width, int height) {
+    cl_int status;
+
+    if (width == s.bound_width && height == s.bound_height) {
+        return;
+    }
+    s.bound_width = width;
+    s.bound_height = height;
+
+    if (kernel_mode == FUSED) {
+        status = clSetKernelArg(s.kernels[FUSED_KERNEL], BUFFER_COUNT, sizeof(int), &width);
+        checkError(status, "Error: could not set laplacian_sharpen kernel arg 4");
+        status = clSetKernelArg(s.kernels[FUSED_KERNEL], BUFFER_COUNT + 1, sizeof(int), &height);
+        checkError(status, "Error: could not set laplacian_sharpen kernel arg 5");
+        return;
+    }
+
+    status = clSetKernelArg(s.kernels[GRAYSCALE_KERNEL], 2, sizeof(int), &width);
+    checkError(status, "Error: could not set grayscale kernel arg 2");
+    status = clSetKernelArg(s.kernels[GRAYSCALE_KERNEL], 3, sizeof(int), &height);
+    checkError(status, "Error: could not set grayscale kernel arg 3");
+
+    status = clSetKernelArg(s.kernels[LAPLACIAN_KERNEL], 2, sizeof(int), &width);
+    checkError(status, "Error: could not set laplacian kernel arg 2");
+    status = clSetKernelArg(s.kernels[LAPLACIAN_KERNEL], 3, sizeof(int), &height);
+    checkError(status, "Error: could not set laplacian kernel arg 3");
+
+    status = clSetKernelArg(s.kernels[SHARPEN_KERNEL], 3, sizeof(int), &width);
+    checkError(status, "Error: could not set sharpen kernel arg 3");
+    status = clSetKernelArg(s.kernels[SHARPEN_KERNEL], 4, sizeof(int), &height);
+    checkError(status, "Error: could not set sharpen kernel arg 4");
+}
@@ -0,0 +1,158 @@
+#ifndef CL_PIPELINE_H
+#define CL_PIPELINE_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+#include "CL/opencl.h"
+#include "image_stats.h"
+#include "profile.h"
+
+// One image handed to cl_pipeline::run_batch(), packed 3 bytes per pixel.
+struct cl_image {
+    const unsigned char* pixels;
+    int width, height;
+};
+
+// Grayscale -> Laplacian -> sharpen on one OpenCL device, set up once and
+// reused for every image.
+//
+// The pipeline owns depth buffer sets ("slots"). Each slot has its own
+// kernel objects, device buffers and pinned host copies, allocated on first
+// use and only reallocated when a later image needs more room, so kernel
+// arguments are bound when a buffer changes and not per image. Uploads,
+// kernels and downloads go to three separate in-order queues and are
+// ordered across them with events, so in a batch one image can upload while
+// the one before it computes and the one before that downloads.
+class cl_pipeline {
+public:
+    enum { GRAYSCALE_KERNEL, LAPLACIAN_KERNEL, SHARPEN_KERNEL, FUSED_KERNEL, KERNEL_COUNT };
+
+    // NDRANGE launches the grayscale, laplacian and sharpen kernels one after
+    // the other; FUSED runs the single work-item laplacian_sharpen kernel,
+    // which writes all three outputs in one pass.
+    enum mode { NDRANGE, FUSED };
+
+    // Widest frame the fused kernels take: MAX_WIDTH in kernel.cl, which
+    // sizes their line buffers. Keep the two in step.
+    enum { FUSED_MAX_WIDTH = 4096 };
+
+    // Called once an image's results are back on the host. The buffers are
+    // only valid during the call; the slot is reused right after it returns.
+    typedef std::function<void(int index, const unsigned char* grayscale, const unsigned char* filtered,
+                               const unsigned char* sharpened)> batch_callback;
+
+    // depth is the number of images in flight in run_batch(); 3 lets upload,
+    // compute and download all overlap. units > 1 (FUSED only) runs every
+    // image as BANDS_PER_UNIT row bands per unit on laplacian_sharpen_band,
+    // for a kernel built with -DLAPLACIAN_UNITS=<units>, from one queue per
+    // unit.
+    // collect_stats (FUSED only) has the kernel gather image_stats in the
+    // same pass; see stats().
+    cl_pipeline(cl_context context, cl_device_id device, cl_program program, mode kernel_mode = NDRANGE,
+                int depth = 3, int units = 1, bool collect_stats = false);
+    ~cl_pipeline();
+
+    // Pinned staging buffer of the first slot for a width x height input
+    // image. Filling it in place saves run() a copy.
+    unsigned char* input(int width, int height);
+
+    // Processes a width x height image packed 3 bytes per pixel and waits for
+    // it. The results stay valid in grayscale(), filtered() and sharpened()
+    // until the next run() or run_batch().
+    void run(const unsigned char* image, int width, int height);
+
+    // Like run(), but uploads straight from image and downloads straight into
+    // the three output buffers, skipping the pinned staging copies. For memory
+    // the caller already shares with someone else, such as a job_ring slot.
+    // grayscale(), filtered() and sharpened() are not updated.
+    void run_direct(const unsigned char* image, int width, int height, unsigned char* grayscale,
+                    unsigned char* filtered, unsigned char* sharpened);
+
+    // Processes count images with up to depth of them in flight. done is
+    // called for every image, in order, from the calling thread.
+    void run_batch(const cl_image* images, int count, const batch_callback& done);
+
+    const unsigned char* grayscale() const { return slots[0].host[GRAYSCALE]; }
+    const unsigned char* filtered() const { return slots[0].host[FILTERED]; }
+    const unsigned char* sharpened() const { return slots[0].host[SHARPENED]; }
+
+    // Statistics of the image that finished last: after run() or
+    // run_direct(), or inside a run_batch() callback. Only filled with
+    // collect_stats; the bands of an image are merged.
+    const image_stats& stats() const { return last_stats; }
+
+    int depth() const { return (int)slots.size(); }
+    int units() const { return (int)compute_queues.size(); }
+
+    // Widest frame run() and friends accept; wider ones are an error.
+    int max_width() const { return kernel_mode == FUSED ? FUSED_MAX_WIDTH : INT_MAX; }
+
+    // Records the device time of every upload, kernel and download into
+    // profile, read from the profiling events as each image finishes. Null
+    // (the default) turns it off.
+    void set_profile(stage_profile* profile) { this->profile = profile; }
+
+private:
+    // Bands per compute unit, dealt round-robin to the unit queues. A queue
+    // whose band finishes early starts its next one on whichever unit is
+    // free, so a slow unit holds up only a small share of the image.
+    enum { BANDS_PER_UNIT = 4 };
+
+    // Every buffer has a device copy and a pinned host copy.
+    enum { INPUT, GRAYSCALE, FILTERED, SHARPENED, BUFFER_COUNT };
+
+    // Commands whose events are kept for the profile.
+    enum { UPLOAD_EVENT, GRAYSCALE_EVENT, LAPLACIAN_EVENT, SHARPEN_EVENT, FUSED_EVENT, DOWNLOAD_GRAYSCALE_EVENT,
+           DOWNLOAD_FILTERED_EVENT, DOWNLOAD_SHARPENED_EVENT, EVENT_COUNT };
+
+    struct slot {
+        cl_kernel kernels[KERNEL_COUNT];
+        cl_mem device[BUFFER_COUNT];
+        cl_mem pinned[BUFFER_COUNT];
+        unsigned char* host[BUFFER_COUNT];
+        size_t capacity[BUFFER_COUNT];
+        int bound_width, bound_height;
+
+        // Last download of the image in flight, or NULL when the slot is free.
+        cl_event done;
+        int image;
+
+        // Profiling events of the image in flight; only set with a profile.
+        cl_event events[EVENT_COUNT];
+        std::vector<cl_event> band_events;
+
+        // One image_stats per band with collect_stats, and how many of them
+        // the image in flight fills.
+        std::vector<cl_mem> stats_device;
+        std::vector<image_stats> band_stats;
+        int stats_bands;
+    };
+
+    void submit(slot& s, const unsigned char* image, int width, int height, unsigned char* const* outputs = NULL);
+    void enqueue_kernels(slot& s, int width, int height, cl_event uploaded, cl_event* computed);
+    void enqueue_bands(slot& s, int height, cl_event uploaded, cl_event* computed);
+    void finish(slot& s, const batch_callback* done);
+    cl_event* event(slot& s, int which);
+    void keep_event(slot& s, int which, cl_event e);
+    void record(slot& s);
+
+    void reserve(slot& s, int width, int height);
+    void grow(slot& s, int which, size_t bytes);
+    void release(slot& s, int which);
+    void bind_buffers(slot& s);
+    void bind_dimensions(slot& s, int width, int height);
+
+    cl_context context;
+    cl_command_queue upload_queue;
+    std::vector<cl_command_queue> compute_queues;  // one per unit
+    cl_command_queue download_queue;
+    mode kernel_mode;
+    std::vector<slot> slots;
+    size_t laplacian_tile[2];
+    stage_profile* profile;
+    image_stats last_stats;
+};
+
+#endif
@@ -1,66 +1,930 @@
+#include "hls.h"
+
+#ifdef HOST_ONLY
+#include <stddef.h>
+#include <deque>
+#include <vector>
+
+// Minimal stand-in for hls::stream so the dataflow top also runs on the host.
+// The stages then run one after another, so a channel only has to queue.
+namespace hls {
+template <typename T>
+class stream {
+public:
+    explicit stream(const char* = 0) {}
+    void write(const T& value) { fifo.push_back(value); }
+    T read() {
+        T value = fifo.front();
+        fifo.pop_front();
+        return value;
+    }
+    bool empty() const { return fifo.empty(); }
+
+private:
+    std::deque<T> fifo;
+};
+}
+
+// Host stand-in for the line buffers below. Synthesis needs them fixed at
+// MAX_WIDTH pixels; on the host they are sized from the frame instead, so
+// the host build takes frames of any width.
+template <typename T, int ROWS>
+class line_buffer {
+public:
+    explicit line_buffer(int width) : width(width), pixels(ROWS * (size_t)width) {}
+    T* operator[](int row) { return &pixels[row * width]; }
+
+private:
+    size_t width;
+    std::vector<T> pixels;
+};
+#define LINE_BUFFER(T, ROWS, name, width) line_buffer<T, ROWS> name(width)
+#else
 #include <hls_stream.h>
 #include <ap_int.h>
 #include <ap_axi_sdata.h>
 
+#define LINE_BUFFER(T, ROWS, name, width) T name[ROWS][MAX_WIDTH]
+#endif
+
+// The sharpen stage needs each grayscale pixel again once the Laplacian has
+// caught up with it, which is one row and one pixel later.
+#define LAPLACIAN_SKEW (MAX_WIDTH + 2)
+
+#if GRAYSCALE_MODE == GRAYSCALE_FLOAT_EXACT
+// 0.299f, 0.587f and 0.114f are exact multiples of 2^-27; these are their values at that scale.
+#define GRAYSCALE_EXACT_SHIFT 27
+#define GRAYSCALE_EXACT_R 40131100ULL
+#define GRAYSCALE_EXACT_G 78785808ULL
+#define GRAYSCALE_EXACT_B 15300821ULL
+
+// Rounds a non-negative value held at 2^-27 scale to a 24-bit significand,
+// ties to even, which is what every single-precision multiply and add does.
+// Values stay below 2^36, so the intermediate float results are exact integers here.
+static unsigned long long round_to_float(unsigned long long value) {
+#pragma HLS INLINE
+    int bits = 0;
+    for (int i = 0; i < 36; i++) {
+#pragma HLS UNROLL
+        if (value >> i) {
+            bits = i + 1;
+        }
+    }
+    if (bits <= 24) {
+        return value;
+    }
+    int drop = bits - 24;
+    unsigned long long half = 1ULL << (drop - 1);
+    unsigned long long rem = value & ((1ULL << drop) - 1);
+    unsigned long long q = value >> drop;
+    if (rem > half || (rem == half && (q & 1))) {
+        q++;
+    }
+    return q << drop;
+}
+#endif
+
+template <typename pixel_t>
+static pixel_t rgb_to_gray(pixel_t r, pixel_t g, pixel_t b) {
+#pragma HLS INLINE
+#if GRAYSCALE_MODE == GRAYSCALE_FLOAT
+    return static_cast<pixel_t>(0.299f * r + 0.587f * g + 0.114f * b);
+#elif GRAYSCALE_MODE == GRAYSCALE_FIXED
+    unsigned int sum = GRAYSCALE_FIXED_COEF(0.299) * r + GRAYSCALE_FIXED_COEF(0.587) * g +
+                       GRAYSCALE_FIXED_COEF(0.114) * b + (1u << (GRAYSCALE_FRAC_BITS - 1));
+    unsigned int gray = sum >> GRAYSCALE_FRAC_BITS;
+    return gray > 255 ? 255 : gray;
+#else
+    // Same operation order as the float expression: (r + g) + b.
+    unsigned long long sum = round_to_float(round_to_float(GRAYSCALE_EXACT_R * r) +
+                                            round_to_float(GRAYSCALE_EXACT_G * g));
+    sum = round_to_float(sum + round_to_float(GRAYSCALE_EXACT_B * b));
+    return static_cast<pixel_t>(sum >> GRAYSCALE_EXACT_SHIFT);
+#endif
+}
+
+template <typename amount_t, typename pixel_t>
+static pixel_t unsharp_pixel(pixel_t original, pixel_t filtered) {
+#pragma HLS INLINE
+    int sharpened_value = amount_t::apply(original, filtered);
+    return sharpened_value < 0 ? 0 : (sharpened_value > 255 ? 255 : sharpened_value);
+}
+
+template <typename pixel_t>
+static pixel_t sharpen_pixel(pixel_t original, pixel_t filtered) {
+#pragma HLS INLINE
+    return unsharp_pixel<unsharp_amount<1> >(original, filtered);
+}
+
+// Shifts the pixel read at (y, x) into the line buffer and the 3x3 window.
+// Past the right or bottom edge (valid == false) zeros are shifted in.
+template <typename buffer_t, typename pixel_t>
+static void laplacian_shift(buffer_t& line_buf, pixel_t window[3][3],
+                            pixel_t pixel, bool valid, int x, int y, int width, int height) {
+#pragma HLS INLINE
+    pixel_t column[3] = {0, 0, 0};
+    if (valid) {
+        // The old padded-buffer version zeroed padded row height-1 and
+        // column width-1, which hold image row height-2 and column
+        // width-2. Keep doing so to stay bit-exact with its output.
+        if ((y == height - 2 && x <= width - 2) || (x == width - 2 && y <= height - 2)) {
+            pixel = 0;
+        }
+        column[0] = line_buf[0][x];
+        column[1] = line_buf[1][x];
+        column[2] = pixel;
+        line_buf[0][x] = column[1];
+        line_buf[1][x] = pixel;
+    }
+
+    for (int ky = 0; ky < 3; ky++) {
+        window[ky][0] = window[ky][1];
+        window[ky][1] = window[ky][2];
+        window[ky][2] = column[ky];
+    }
+}
+
+// Applies the stencil to the window centred on (cx, cy); borders are zero.
+template <typename pixel_t>
+static pixel_t laplacian_apply(pixel_t window[3][3], int cx, int cy, int width, int height) {
+#pragma HLS INLINE
+    if (cy == 0 || cx == 0 || cy == height - 1 || cx == width - 1) {
+        return 0;
+    }
+    int filtered_value = laplacian4::apply(window);
+    return filtered_value < 0 ? 0 : (filtered_value > 255 ? 255 : filtered_value);
+}
+
 // Kernel for grayscale conversion
-void grayscale(ap_uint<8>* input_image, ap_uint<8>* output_image, const int width, const int height) 
-{
+template <typename pixel_t>
+void grayscale(const pixel_t* input_image, pixel_t* output_image, int width, int height) {
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
             int idx = (y * width + x) * 3;
-            ap_uint<8> r = input_image[idx];
-            ap_uint<8> g = input_image[idx + 1];
-            ap_uint<8> b = input_image[idx + 2];
-            ap_uint<8> gray = static_cast<ap_uint<8>>(0.299f * r + 0.587f * g + 0.114f * b);
-            output_image[y * width + x] = gray;
+            pixel_t r = input_image[idx];
+            pixel_t g = input_image[idx + 1];
+            pixel_t b = input_image[idx + 2];
+            output_image[y * width + x] = rgb_to_gray(r, g, b);
         }
     }
 }
 
 // Kernel for Laplacian filtering
-void laplacian(ap_uint<8>* grayscale_output, ap_uint<8>* padded, ap_uint<8>* filtered_output, int width, int height) {
-    int padded_width = width + 2;
-    int padded_height = height + 2;
+// The frame is streamed once through a two-row line buffer feeding a 3x3
+// window, so no padded copy of the image is needed. The window centre lags
+// the incoming pixel by one row and one column; the extra row/column of
+// iterations at the end flushes the last outputs so one pixel leaves per clock.
+template <typename pixel_t>
+void laplacian(const pixel_t* grayscale_output, pixel_t* filtered_output, int width, int height) {
+    LINE_BUFFER(pixel_t, 2, line_buf, width);
+    pixel_t window[3][3];
+#pragma HLS ARRAY_PARTITION variable=line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=window complete dim=0
+
+    for (int y = 0; y <= height; y++) {
+        for (int x = 0; x <= width; x++) {
+#pragma HLS PIPELINE II=1
+            bool valid = y < height && x < width;
+            pixel_t pixel = valid ? grayscale_output[y * width + x] : pixel_t(0);
+            laplacian_shift(line_buf, window, pixel, valid, x, y, width, height);
+            if (y > 0 && x > 0) {
+                filtered_output[(y - 1) * width + (x - 1)] = laplacian_apply(window, x - 1, y - 1, width, height);
+            }
+        }
+    }
+}
 
+// Kernel for sharpening
+template <typename pixel_t>
+void sharpen(const pixel_t* original_image, const pixel_t* filtered_output, pixel_t* sharpened_output,
+             int width, int height) {
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
             int idx = y * width + x;
-            padded[(y + 1) * padded_width + (x + 1)] = grayscale_output[idx];
+            sharpened_output[idx] = sharpen_pixel(original_image[idx], filtered_output[idx]);
+        }
+    }
+}
+
+// Kernel for filtering with any stencil from stencil.h
+// Same scheme as laplacian(), with K - 1 line buffers and a K x K window whose
+// centre lags the input by K / 2 rows and columns.
+template <typename stencil_t, typename pixel_t>
+void stencil_filter(const pixel_t* grayscale_output, pixel_t* filtered_output, int width, int height) {
+    const int K = stencil_t::size;
+    const int R = K / 2;
+    LINE_BUFFER(pixel_t, K - 1, line_buf, width);
+    pixel_t window[K][K];
+#pragma HLS ARRAY_PARTITION variable=line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=window complete dim=0
+
+    for (int y = 0; y < height + R; y++) {
+        for (int x = 0; x < width + R; x++) {
+#pragma HLS PIPELINE II=1
+            pixel_t column[K];
+            for (int ky = 0; ky < K; ky++) {
+                column[ky] = 0;
+            }
+            if (y < height && x < width) {
+                for (int ky = 0; ky < K - 1; ky++) {
+                    column[ky] = line_buf[ky][x];
+                }
+                column[K - 1] = grayscale_output[y * width + x];
+                for (int ky = 0; ky < K - 1; ky++) {
+                    line_buf[ky][x] = column[ky + 1];
+                }
+            }
+
+            for (int ky = 0; ky < K; ky++) {
+                for (int kx = 0; kx < K - 1; kx++) {
+                    window[ky][kx] = window[ky][kx + 1];
+                }
+                window[ky][K - 1] = column[ky];
+            }
+
+            int cx = x - R;
+            int cy = y - R;
+            if (cy >= 0 && cx >= 0) {
+                int filtered_value = 0;
+                if (cy >= R && cx >= R && cy < height - R && cx < width - R) {
+                    filtered_value = stencil_t::apply(window);
+                }
+                filtered_output[cy * width + cx] =
+                    filtered_value < 0 ? 0 : (filtered_value > 255 ? 255 : filtered_value);
+            }
         }
     }
+}
 
+// Kernel for sharpening with a compile-time amount
+template <typename amount_t, typename pixel_t>
+void unsharp(const pixel_t* original_image, const pixel_t* filtered_output, pixel_t* sharpened_output,
+             int width, int height) {
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
-            if (x == 0 || y == 0 || x == width - 1 || y == height - 1) {
-                padded[y * padded_width + x] = 0;
-            }
+            int idx = y * width + x;
+            sharpened_output[idx] = unsharp_pixel<amount_t>(original_image[idx], filtered_output[idx]);
         }
     }
+}
 
-    for (int y = 1; y < height - 1; y++) {
-        for (int x = 1; x < width - 1; x++) {
+// Dataflow stages of laplacian_sharpen_band(). The band is rows first_row ..
+// first_row + rows - 1 of the frame; the grayscale and Laplacian stages also
+// stream the halo rows [top, bottom) around it, which only feed the stencil.
+// With STATS each stage also totals its part of the band's image_stats and
+// sends it on its own stream once its pixels are done; the halo rows are not
+// counted.
+template <bool STATS, typename pixel_t>
+static void grayscale_stage(const pixel_t* input_image, pixel_t* grayscale_output, bool tap_grayscale,
+                            hls::stream<pixel_t>& to_laplacian, hls::stream<pixel_t>& to_sharpen,
+                            int width, int top, int bottom, int first_row, int rows,
+                            hls::stream<uint32_t>& histogram) {
+    // Consecutive pixels go to alternate banks, so one bin is never
+    // incremented on two clocks in a row.
+    uint32_t counts[2][256];
+#pragma HLS ARRAY_PARTITION variable=counts complete dim=1
+    if (STATS) {
+        for (int i = 0; i < 256; i++) {
+#pragma HLS PIPELINE II=1
+            counts[0][i] = 0;
+            counts[1][i] = 0;
+        }
+    }
+
+    int bank = 0;
+    for (int y = top; y < bottom; y++) {
+        bool in_band = y >= first_row && y < first_row + rows;
+        for (int x = 0; x < width; x++) {
+#pragma HLS PIPELINE II=1
+#pragma HLS DEPENDENCE variable=counts inter distance=2 true
             int idx = y * width + x;
-            int laplacian[3][3] = {{0, -1, 0}, {-1, 4, -1}, {0, -1, 0}};
-            int filtered_value = 0;
-            for (int ky = -1; ky <= 1; ky++) {
-                for (int kx = -1; kx <= 1; kx++) {
-                    int pixel = padded[(y + ky + 1) * padded_width + (x + kx + 1)];
-                    filtered_value += pixel * laplacian[ky + 1][kx + 1];
+            pixel_t gray = rgb_to_gray(input_image[idx * 3], input_image[idx * 3 + 1], input_image[idx * 3 + 2]);
+            to_laplacian.write(gray);
+            if (in_band) {
+                to_sharpen.write(gray);
+                if (tap_grayscale) {
+                    grayscale_output[idx] = gray;
+                }
+                if (STATS) {
+                    counts[bank][(int)gray]++;
+                    bank ^= 1;
                 }
             }
-            filtered_output[idx] = filtered_value < 0 ? 0 : (filtered_value > 255 ? 255 : filtered_value);
+        }
+    }
+
+    if (STATS) {
+        for (int i = 0; i < 256; i++) {
+#pragma HLS PIPELINE II=1
+            histogram.write(counts[0][i] + counts[1][i]);
         }
     }
 }
 
-// Kernel for sharpening
-void sharpen(ap_uint<8>* original_image, ap_uint<8>* filtered_output, ap_uint<8>* sharpened_output, int width, int height) {
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = y * width + x;
-            int sharpened_value = original_image[idx] + filtered_output[idx];
-            sharpened_output[idx] = sharpened_value < 0 ? 0 : (sharpened_value > 255 ? 255 : sharpened_value);
+template <bool STATS, typename pixel_t>
+static void laplacian_stage(hls::stream<pixel_t>& in, hls::stream<pixel_t>& out,
+                            pixel_t* filtered_output, bool tap_filtered, int width, int height,
+                            int top, int bottom, int first_row, int rows, hls::stream<uint64_t>& totals) {
+    LINE_BUFFER(pixel_t, 2, line_buf, width);
+    pixel_t window[3][3];
+#pragma HLS ARRAY_PARTITION variable=line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=window complete dim=0
+    uint64_t sum = 0, sum_squares = 0;
+
+    // y is the frame row being read; the window centre is on row y - 1.
+    for (int y = top; y <= bottom; y++) {
+        bool in_band = y - 1 >= first_row && y - 1 < first_row + rows;
+        for (int x = 0; x <= width; x++) {
+#pragma HLS PIPELINE II=1
+            bool valid = y < bottom && x < width;
+            pixel_t pixel = valid ? in.read() : pixel_t(0);
+            laplacian_shift(line_buf, window, pixel, valid, x, y, width, height);
+            if (in_band && x > 0) {
+                pixel_t filtered = laplacian_apply(window, x - 1, y - 1, width, height);
+                out.write(filtered);
+                if (tap_filtered) {
+                    filtered_output[(y - 1) * width + (x - 1)] = filtered;
+                }
+                if (STATS) {
+                    int value = filtered;
+                    sum += value;
+                    sum_squares += value * value;
+                }
+            }
         }
     }
+
+    if (STATS) {
+        totals.write(sum);
+        totals.write(sum_squares);
+    }
+}
+
+template <bool STATS, typename pixel_t>
+static void sharpen_stage(hls::stream<pixel_t>& gray, hls::stream<pixel_t>& filtered,
+                          pixel_t* sharpened_output, int width, int first_row, int rows,
+                          hls::stream<uint32_t>& totals) {
+    uint32_t count = 0;
+    for (int idx = first_row * width; idx < (first_row + rows) * width; idx++) {
+#pragma HLS PIPELINE II=1
+        pixel_t original = gray.read();
+        pixel_t laplacian = filtered.read();
+        sharpened_output[idx] = sharpen_pixel(original, laplacian);
+        if (STATS && (int)original + (int)laplacian > 255) {
+            count++;
+        }
+    }
+
+    if (STATS) {
+        totals.write(count);
+        totals.write((uint32_t)(rows * width));
+    }
+}
+
+// Last process of the band: the only one that writes stats, which at the top
+// level is an m_axi port of its own.
+template <bool STATS>
+static void write_stats(hls::stream<uint32_t>& histogram, hls::stream<uint64_t>& laplacian_totals,
+                        hls::stream<uint32_t>& sharpen_totals, image_stats& stats) {
+    if (!STATS) {
+        return;
+    }
+    for (int i = 0; i < 256; i++) {
+#pragma HLS PIPELINE II=1
+        stats.histogram[i] = histogram.read();
+    }
+    stats.laplacian_sum = laplacian_totals.read();
+    stats.laplacian_sum_squares = laplacian_totals.read();
+    stats.clipped = sharpen_totals.read();
+    stats.pixels = sharpen_totals.read();
 }
 
+// The three stages run concurrently and pass pixels over streams, so only the
+// RGB frame is read from and the sharpened frame written to memory. The
+// grayscale and filtered frames are written as well only when their tap is set.
+// A band reads one RGB row above and below itself, where the frame has them,
+// and writes only its own rows, so several units can share the frame buffers.
+template <bool STATS, typename pixel_t>
+static void fused_band(const pixel_t* input_image, pixel_t* sharpened_output,
+                       pixel_t* grayscale_output, pixel_t* filtered_output,
+                       bool tap_grayscale, bool tap_filtered, int width, int height,
+                       int first_row, int rows, image_stats& stats) {
+#pragma HLS DATAFLOW
+    hls::stream<pixel_t> gray_to_laplacian("gray_to_laplacian");
+    hls::stream<pixel_t> gray_to_sharpen("gray_to_sharpen");
+    hls::stream<pixel_t> laplacian_to_sharpen("laplacian_to_sharpen");
+    hls::stream<uint32_t> histogram("histogram");
+    hls::stream<uint64_t> laplacian_totals("laplacian_totals");
+    hls::stream<uint32_t> sharpen_totals("sharpen_totals");
+#pragma HLS STREAM variable=gray_to_sharpen depth=LAPLACIAN_SKEW
+
+    int top = first_row > 0 ? first_row - 1 : 0;
+    int bottom = first_row + rows < height ? first_row + rows + 1 : height;
+    grayscale_stage<STATS>(input_image, grayscale_output, tap_grayscale, gray_to_laplacian, gray_to_sharpen, width,
+                           top, bottom, first_row, rows, histogram);
+    laplacian_stage<STATS>(gray_to_laplacian, laplacian_to_sharpen, filtered_output, tap_filtered, width, height,
+                           top, bottom, first_row, rows, laplacian_totals);
+    sharpen_stage<STATS>(gray_to_sharpen, laplacian_to_sharpen, sharpened_output, width, first_row, rows,
+                         sharpen_totals);
+    write_stats<STATS>(histogram, laplacian_totals, sharpen_totals, stats);
+}
+
+// Fused grayscale -> Laplacian -> sharpen.
+template <typename pixel_t>
+void laplacian_sharpen(const pixel_t* input_image, pixel_t* sharpened_output,
+                       pixel_t* grayscale_output, pixel_t* filtered_output,
+                       bool tap_grayscale, bool tap_filtered, int width, int height) {
+    laplacian_sharpen_band(input_image, sharpened_output, grayscale_output, filtered_output, tap_grayscale,
+                           tap_filtered, width, height, 0, height);
+}
+
+template <typename pixel_t>
+void laplacian_sharpen_band(const pixel_t* input_image, pixel_t* sharpened_output,
+                            pixel_t* grayscale_output, pixel_t* filtered_output,
+                            bool tap_grayscale, bool tap_filtered, int width, int height,
+                            int first_row, int rows) {
+    // Never written without STATS.
+    image_stats unused;
+    fused_band<false>(input_image, sharpened_output, grayscale_output, filtered_output, tap_grayscale,
+                      tap_filtered, width, height, first_row, rows, unused);
+}
+
+template <typename pixel_t>
+void laplacian_sharpen_stats(const pixel_t* input_image, pixel_t* sharpened_output,
+                             pixel_t* grayscale_output, pixel_t* filtered_output,
+                             bool tap_grayscale, bool tap_filtered, int width, int height, image_stats& stats) {
+    laplacian_sharpen_stats_band(input_image, sharpened_output, grayscale_output, filtered_output, tap_grayscale,
+                                 tap_filtered, width, height, 0, height, stats);
+}
+
+template <typename pixel_t>
+void laplacian_sharpen_stats_band(const pixel_t* input_image, pixel_t* sharpened_output,
+                                  pixel_t* grayscale_output, pixel_t* filtered_output,
+                                  bool tap_grayscale, bool tap_filtered, int width, int height,
+                                  int first_row, int rows, image_stats& stats) {
+    fused_band<true>(input_image, sharpened_output, grayscale_output, filtered_output, tap_grayscale,
+                     tap_filtered, width, height, first_row, rows, stats);
+}
+
+#ifndef HOST_ONLY
+// Wide-bus kernels. Memory is only touched by read_words() and write_words(),
+// one 512-bit word per clock in sequential bursts. The frames travel between
+// them as N-pixel chunks, so every stage handles N pixels per clock.
+
+template <int N>
+struct lanes {
+    typedef ap_uint<8 * N> type;
+};
+
+static void read_words(const wide_t* frame, hls::stream<wide_t>& words, int count) {
+    for (int i = 0; i < count; i++) {
+#pragma HLS PIPELINE II=1
+        words.write(frame[i]);
+    }
+}
+
+static void write_words(hls::stream<wide_t>& words, wide_t* frame, int count) {
+    for (int i = 0; i < count; i++) {
+#pragma HLS PIPELINE II=1
+        frame[i] = words.read();
+    }
+}
+
+// Cuts the byte stream carried by words into rows of row_bytes bytes, each
+// sent as ceil(row_bytes / BYTES) chunks of BYTES bytes. The last chunk of a
+// row is zero past the end of the row.
+template <int BYTES>
+static void unpack_chunks(hls::stream<wide_t>& words, hls::stream<ap_uint<8 * BYTES> >& chunks,
+                          int row_bytes, int rows) {
+    ap_uint<8 * (WIDE_BYTES + BYTES)> buffer = 0;
+    int held = 0;
+    int per_row = (row_bytes + BYTES - 1) / BYTES;
+
+    for (int y = 0; y < rows; y++) {
+        for (int c = 0; c < per_row; c++) {
+#pragma HLS PIPELINE II=1
+            int take = row_bytes - c * BYTES < BYTES ? row_bytes - c * BYTES : BYTES;
+            if (held < take) {
+                ap_uint<8 * (WIDE_BYTES + BYTES)> word = words.read();
+                buffer |= word << (8 * held);
+                held += WIDE_BYTES;
+            }
+            ap_uint<8 * BYTES> chunk = buffer.range(8 * BYTES - 1, 0);
+            for (int i = 0; i < BYTES; i++) {
+#pragma HLS UNROLL
+                if (i >= take) {
+                    chunk.range(8 * i + 7, 8 * i) = 0;
+                }
+            }
+            buffer >>= 8 * take;
+            held -= take;
+            chunks.write(chunk);
+        }
+    }
+}
+
+// Inverse of unpack_chunks(): keeps the first row_bytes bytes of every row
+// and packs them back to back into words, the last one zero-filled.
+template <int BYTES>
+static void pack_chunks(hls::stream<ap_uint<8 * BYTES> >& chunks, hls::stream<wide_t>& words,
+                        int row_bytes, int rows) {
+    ap_uint<8 * (WIDE_BYTES + BYTES)> buffer = 0;
+    int held = 0;
+    int per_row = (row_bytes + BYTES - 1) / BYTES;
+
+    for (int y = 0; y < rows; y++) {
+        for (int c = 0; c < per_row; c++) {
+#pragma HLS PIPELINE II=1
+            int take = row_bytes - c * BYTES < BYTES ? row_bytes - c * BYTES : BYTES;
+            ap_uint<8 * BYTES> chunk = chunks.read();
+            for (int i = 0; i < BYTES; i++) {
+#pragma HLS UNROLL
+                if (i >= take) {
+                    chunk.range(8 * i + 7, 8 * i) = 0;
+                }
+            }
+            ap_uint<8 * (WIDE_BYTES + BYTES)> wide_chunk = chunk;
+            buffer |= wide_chunk << (8 * held);
+            held += take;
+            if (held >= WIDE_BYTES) {
+                words.write(buffer.range(8 * WIDE_BYTES - 1, 0));
+                buffer >>= 8 * WIDE_BYTES;
+                held -= WIDE_BYTES;
+            }
+        }
+    }
+    if (held > 0) {
+        words.write(buffer.range(8 * WIDE_BYTES - 1, 0));
+    }
+}
+
+// Lane i's 3x3 window inside the N + 2 wide window of laplacian_lanes().
+template <int N>
+struct lane_window {
+    const int (*window)[N + 2];
+    int lane;
+    const int* operator[](int ky) const { return window[ky] + lane; }
+};
+
+template <int N>
+static void grayscale_lanes(hls::stream<ap_uint<24 * N> >& rgb, hls::stream<typename lanes<N>::type>& gray,
+                            int width, int height) {
+    int chunks = height * ((width + N - 1) / N);
+    for (int c = 0; c < chunks; c++) {
+#pragma HLS PIPELINE II=1
+        ap_uint<24 * N> in = rgb.read();
+        typename lanes<N>::type out;
+        for (int i = 0; i < N; i++) {
+#pragma HLS UNROLL
+            ap_uint<8> r = in.range(24 * i + 7, 24 * i);
+            ap_uint<8> g = in.range(24 * i + 15, 24 * i + 8);
+            ap_uint<8> b = in.range(24 * i + 23, 24 * i + 16);
+            out.range(8 * i + 7, 8 * i) = rgb_to_gray(r, g, b);
+        }
+        gray.write(out);
+    }
+}
+
+// N-lane version of laplacian(): the line buffers hold N pixels per entry and
+// the window is N + 2 pixels wide, so a chunk of N outputs comes out per
+// clock, one row and one chunk behind the input.
+template <int N>
+static void laplacian_lanes(hls::stream<typename lanes<N>::type>& in, hls::stream<typename lanes<N>::type>& out,
+                            int width, int height) {
+    typedef typename lanes<N>::type lanes_t;
+    lanes_t line_buf[2][MAX_WIDTH / N];
+    lanes_t previous[3] = {0, 0, 0};
+    ap_uint<8> edge[3] = {0, 0, 0};
+#pragma HLS ARRAY_PARTITION variable=line_buf complete dim=1
+#pragma HLS ARRAY_PARTITION variable=previous complete dim=0
+#pragma HLS ARRAY_PARTITION variable=edge complete dim=0
+
+    int chunks = (width + N - 1) / N;
+    for (int y = 0; y <= height; y++) {
+        for (int c = 0; c <= chunks; c++) {
+#pragma HLS PIPELINE II=1
+            lanes_t column[3] = {0, 0, 0};
+            if (y < height && c < chunks) {
+                lanes_t pixels = in.read();
+                // Same compatibility zeroing as laplacian_shift().
+                for (int i = 0; i < N; i++) {
+#pragma HLS UNROLL
+                    int x = c * N + i;
+                    if ((y == height - 2 && x <= width - 2) || (x == width - 2 && y <= height - 2)) {
+                        pixels.range(8 * i + 7, 8 * i) = 0;
+                    }
+                }
+                column[0] = line_buf[0][c];
+                column[1] = line_buf[1][c];
+                column[2] = pixels;
+                line_buf[0][c] = column[1];
+                line_buf[1][c] = pixels;
+            }
+
+            if (y > 0 && c > 0) {
+                // Rows y-2 .. y of columns (c-1)*N - 1 .. c*N.
+                int window[3][N + 2];
+#pragma HLS ARRAY_PARTITION variable=window complete dim=0
+                for (int ky = 0; ky < 3; ky++) {
+#pragma HLS UNROLL
+                    window[ky][0] = edge[ky];
+                    for (int i = 0; i < N; i++) {
+#pragma HLS UNROLL
+                        window[ky][i + 1] = (int)previous[ky].range(8 * i + 7, 8 * i);
+                    }
+                    window[ky][N + 1] = (int)column[ky].range(7, 0);
+                }
+
+                lanes_t filtered;
+                for (int i = 0; i < N; i++) {
+#pragma HLS UNROLL
+                    int cx = (c - 1) * N + i;
+                    int cy = y - 1;
+                    int filtered_value = 0;
+                    if (cx > 0 && cy > 0 && cx < width - 1 && cy < height - 1) {
+                        lane_window<N> lane = {window, i};
+                        filtered_value = laplacian4::apply(lane);
+                    }
+                    filtered.range(8 * i + 7, 8 * i) =
+                        filtered_value < 0 ? 0 : (filtered_value > 255 ? 255 : filtered_value);
+                }
+                out.write(filtered);
+            }
+
+            for (int ky = 0; ky < 3; ky++) {
+#pragma HLS UNROLL
+                edge[ky] = previous[ky].range(8 * N - 1, 8 * N - 8);
+                previous[ky] = column[ky];
+            }
+        }
+    }
+}
+
+template <int N>
+static void sharpen_lanes(hls::stream<typename lanes<N>::type>& original, hls::stream<typename lanes<N>::type>& filtered,
+                          hls::stream<typename lanes<N>::type>& sharpened, int width, int height) {
+    int chunks = height * ((width + N - 1) / N);
+    for (int c = 0; c < chunks; c++) {
+#pragma HLS PIPELINE II=1
+        typename lanes<N>::type a = original.read();
+        typename lanes<N>::type b = filtered.read();
+        typename lanes<N>::type out;
+        for (int i = 0; i < N; i++) {
+#pragma HLS UNROLL
+            ap_uint<8> pixel_a = a.range(8 * i + 7, 8 * i);
+            ap_uint<8> pixel_b = b.range(8 * i + 7, 8 * i);
+            out.range(8 * i + 7, 8 * i) = sharpen_pixel(pixel_a, pixel_b);
+        }
+        sharpened.write(out);
+    }
+}
+
+template <int N>
+void grayscale_wide(const wide_t* input_image, wide_t* output_image, int width, int height) {
+#pragma HLS DATAFLOW
+    hls::stream<wide_t> in_words("in_words");
+    hls::stream<wide_t> out_words("out_words");
+    hls::stream<ap_uint<24 * N> > rgb("rgb");
+    hls::stream<typename lanes<N>::type> gray("gray");
+
+    read_words(input_image, in_words, WIDE_WORDS(width * height * 3));
+    unpack_chunks<3 * N>(in_words, rgb, width * 3, height);
+    grayscale_lanes<N>(rgb, gray, width, height);
+    pack_chunks<N>(gray, out_words, width, height);
+    write_words(out_words, output_image, WIDE_WORDS(width * height));
+}
+
+template <int N>
+void laplacian_wide(const wide_t* grayscale_output, wide_t* filtered_output, int width, int height) {
+#pragma HLS DATAFLOW
+    hls::stream<wide_t> in_words("in_words");
+    hls::stream<wide_t> out_words("out_words");
+    hls::stream<typename lanes<N>::type> gray("gray");
+    hls::stream<typename lanes<N>::type> filtered("filtered");
+
+    read_words(grayscale_output, in_words, WIDE_WORDS(width * height));
+    unpack_chunks<N>(in_words, gray, width, height);
+    laplacian_lanes<N>(gray, filtered, width, height);
+    pack_chunks<N>(filtered, out_words, width, height);
+    write_words(out_words, filtered_output, WIDE_WORDS(width * height));
+}
+
+template <int N>
+void sharpen_wide(const wide_t* original_image, const wide_t* filtered_output, wide_t* sharpened_output,
+                  int width, int height) {
+#pragma HLS DATAFLOW
+    hls::stream<wide_t> original_words("original_words");
+    hls::stream<wide_t> filtered_words("filtered_words");
+    hls::stream<wide_t> out_words("out_words");
+    hls::stream<typename lanes<N>::type> original("original");
+    hls::stream<typename lanes<N>::type> filtered("filtered");
+    hls::stream<typename lanes<N>::type> sharpened("sharpened");
+
+    read_words(original_image, original_words, WIDE_WORDS(width * height));
+    read_words(filtered_output, filtered_words, WIDE_WORDS(width * height));
+    unpack_chunks<N>(original_words, original, width, height);
+    unpack_chunks<N>(filtered_words, filtered, width, height);
+    sharpen_lanes<N>(original, filtered, sharpened, width, height);
+    pack_chunks<N>(sharpened, out_words, width, height);
+    write_words(out_words, sharpened_output, WIDE_WORDS(width * height));
+}
+#endif
+
+template void grayscale<uint8_t>(const uint8_t*, uint8_t*, int, int);
+template void laplacian<uint8_t>(const uint8_t*, uint8_t*, int, int);
+template void sharpen<uint8_t>(const uint8_t*, const uint8_t*, uint8_t*, int, int);
+template void laplacian_sharpen<uint8_t>(const uint8_t*, uint8_t*, uint8_t*, uint8_t*, bool, bool, int, int);
+template void laplacian_sharpen_band<uint8_t>(const uint8_t*, uint8_t*, uint8_t*, uint8_t*, bool, bool, int, int,
+                                              int, int);
+template void laplacian_sharpen_stats<uint8_t>(const uint8_t*, uint8_t*, uint8_t*, uint8_t*, bool, bool, int, int,
+                                               image_stats&);
+template void laplacian_sharpen_stats_band<uint8_t>(const uint8_t*, uint8_t*, uint8_t*, uint8_t*, bool, bool, int,
+                                                    int, int, int, image_stats&);
+
+#define STENCIL_INSTANTIATE(pixel_t) \
+    template void stencil_filter<laplacian4, pixel_t>(const pixel_t*, pixel_t*, int, int); \
+    template void stencil_filter<laplacian8, pixel_t>(const pixel_t*, pixel_t*, int, int); \
+    template void stencil_filter<laplacian_of_gaussian5, pixel_t>(const pixel_t*, pixel_t*, int, int); \
+    template void unsharp<unsharp_amount<1, 1>, pixel_t>(const pixel_t*, const pixel_t*, pixel_t*, int, int); \
+    template void unsharp<unsharp_amount<1>, pixel_t>(const pixel_t*, const pixel_t*, pixel_t*, int, int); \
+    template void unsharp<unsharp_amount<3, 1>, pixel_t>(const pixel_t*, const pixel_t*, pixel_t*, int, int); \
+    template void unsharp<unsharp_amount<2>, pixel_t>(const pixel_t*, const pixel_t*, pixel_t*, int, int);
+STENCIL_INSTANTIATE(uint8_t)
+
+#ifndef HOST_ONLY
+template void grayscale<ap_uint<8>>(const ap_uint<8>*, ap_uint<8>*, int, int);
+template void laplacian<ap_uint<8>>(const ap_uint<8>*, ap_uint<8>*, int, int);
+template void sharpen<ap_uint<8>>(const ap_uint<8>*, const ap_uint<8>*, ap_uint<8>*, int, int);
+template void laplacian_sharpen<ap_uint<8>>(const ap_uint<8>*, ap_uint<8>*, ap_uint<8>*, ap_uint<8>*,
+                                            bool, bool, int, int);
+template void laplacian_sharpen_band<ap_uint<8>>(const ap_uint<8>*, ap_uint<8>*, ap_uint<8>*, ap_uint<8>*,
+                                                 bool, bool, int, int, int, int);
+template void laplacian_sharpen_stats<ap_uint<8>>(const ap_uint<8>*, ap_uint<8>*, ap_uint<8>*, ap_uint<8>*,
+                                                  bool, bool, int, int, image_stats&);
+template void laplacian_sharpen_stats_band<ap_uint<8>>(const ap_uint<8>*, ap_uint<8>*, ap_uint<8>*, ap_uint<8>*,
+                                                       bool, bool, int, int, int, int, image_stats&);
+STENCIL_INSTANTIATE(ap_uint<8>)
+
+#define WIDE_INSTANTIATE(N) \
+    template void grayscale_wide<N>(const wide_t*, wide_t*, int, int); \
+    template void laplacian_wide<N>(const wide_t*, wide_t*, int, int); \
+    template void sharpen_wide<N>(const wide_t*, const wide_t*, wide_t*, int, int);
+WIDE_INSTANTIATE(1)
+WIDE_INSTANTIATE(2)
+WIDE_INSTANTIATE(4)
+WIDE_INSTANTIATE(8)
+WIDE_INSTANTIATE(16)
+
+void grayscale_top(ap_uint<8>* input_image, ap_uint<8>* output_image, int width, int height) {
+#pragma HLS INTERFACE m_axi port=input_image offset=slave bundle=gmem0
+#pragma HLS INTERFACE m_axi port=output_image offset=slave bundle=gmem1
+#pragma HLS INTERFACE s_axilite port=width
+#pragma HLS INTERFACE s_axilite port=height
+#pragma HLS INTERFACE s_axilite port=return
+    grayscale(input_image, output_image, width, height);
+}
+
+void laplacian_top(ap_uint<8>* grayscale_output, ap_uint<8>* filtered_output, int width, int height) {
+#pragma HLS INTERFACE m_axi port=grayscale_output offset=slave bundle=gmem0
+#pragma HLS INTERFACE m_axi port=filtered_output offset=slave bundle=gmem1
+#pragma HLS INTERFACE s_axilite port=width
+#pragma HLS INTERFACE s_axilite port=height
+#pragma HLS INTERFACE s_axilite port=return
+    laplacian(grayscale_output, filtered_output, width, height);
+}
+
+void sharpen_top(ap_uint<8>* original_image, ap_uint<8>* filtered_output, ap_uint<8>* sharpened_output,
+                 int width, int height) {
+#pragma HLS INTERFACE m_axi port=original_image offset=slave bundle=gmem0
+#pragma HLS INTERFACE m_axi port=filtered_output offset=slave bundle=gmem1
+#pragma HLS INTERFACE m_axi port=sharpened_output offset=slave bundle=gmem2
+#pragma HLS INTERFACE s_axilite port=width
+#pragma HLS INTERFACE s_axilite port=height
+#pragma HLS INTERFACE s_axilite port=return
+    sharpen(original_image, filtered_output, sharpened_output, width, height);
+}
+
+void laplacian_sharpen_top(ap_uint<8>* input_image, ap_uint<8>* sharpened_output,
+                           ap_uint<8>* grayscale_output, ap_uint<8>* filtered_output,
+                           bool tap_grayscale, bool tap_filtered, int width, int height) {
+#pragma HLS INTERFACE m_axi port=input_image offset=slave bundle=gmem0
+#pragma HLS INTERFACE m_axi port=sharpened_output offset=slave bundle=gmem1
+#pragma HLS INTERFACE m_axi port=grayscale_output offset=slave bundle=gmem2
+#pragma HLS INTERFACE m_axi port=filtered_output offset=slave bundle=gmem3
+#pragma HLS INTERFACE s_axilite port=tap_grayscale
+#pragma HLS INTERFACE s_axilite port=tap_filtered
+#pragma HLS INTERFACE s_axilite port=width
+#pragma HLS INTERFACE s_axilite port=height
+#pragma HLS INTERFACE s_axilite port=return
+    laplacian_sharpen(input_image, sharpened_output, grayscale_output, filtered_output,
+                      tap_grayscale, tap_filtered, width, height);
+}
+
+void laplacian_sharpen_band_top(ap_uint<8>* input_image, ap_uint<8>* sharpened_output,
+                                ap_uint<8>* grayscale_output, ap_uint<8>* filtered_output,
+                                bool tap_grayscale, bool tap_filtered, int width, int height,
+                                int first_row, int rows) {
+#pragma HLS INTERFACE m_axi port=input_image offset=slave bundle=gmem0
+#pragma HLS INTERFACE m_axi port=sharpened_output offset=slave bundle=gmem1
+#pragma HLS INTERFACE m_axi port=grayscale_output offset=slave bundle=gmem2
+#pragma HLS INTERFACE m_axi port=filtered_output offset=slave bundle=gmem3
+#pragma HLS INTERFACE s_axilite port=tap_grayscale
+#pragma HLS INTERFACE s_axilite port=tap_filtered
+#pragma HLS INTERFACE s_axilite port=width
+#pragma HLS INTERFACE s_axilite port=height
+#pragma HLS INTERFACE s_axilite port=first_row
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=return
+    laplacian_sharpen_band(input_image, sharpened_output, grayscale_output, filtered_output,
+                           tap_grayscale, tap_filtered, width, height, first_row, rows);
+}
+
+void laplacian_sharpen_stats_top(ap_uint<8>* input_image, ap_uint<8>* sharpened_output,
+                                 ap_uint<8>* grayscale_output, ap_uint<8>* filtered_output,
+                                 bool tap_grayscale, bool tap_filtered, int width, int height, image_stats* stats) {
+#pragma HLS INTERFACE m_axi port=input_image offset=slave bundle=gmem0
+#pragma HLS INTERFACE m_axi port=sharpened_output offset=slave bundle=gmem1
+#pragma HLS INTERFACE m_axi port=grayscale_output offset=slave bundle=gmem2
+#pragma HLS INTERFACE m_axi port=filtered_output offset=slave bundle=gmem3
+#pragma HLS INTERFACE m_axi port=stats offset=slave bundle=gmem4
+#pragma HLS INTERFACE s_axilite port=tap_grayscale
+#pragma HLS INTERFACE s_axilite port=tap_filtered
+#pragma HLS INTERFACE s_axilite port=width
+#pragma HLS INTERFACE s_axilite port=height
+#pragma HLS INTERFACE s_axilite port=return
+    laplacian_sharpen_stats(input_image, sharpened_output, grayscale_output, filtered_output,
+                            tap_grayscale, tap_filtered, width, height, *stats);
+}
+
+void laplacian_sharpen_stats_band_top(ap_uint<8>* input_image, ap_uint<8>* sharpened_output,
+                                      ap_uint<8>* grayscale_output, ap_uint<8>* filtered_output,
+                                      bool tap_grayscale, bool tap_filtered, int width, int height,
+                                      int first_row, int rows, image_stats* stats) {
+#pragma HLS INTERFACE m_axi port=input_image offset=slave bundle=gmem0
+#pragma HLS INTERFACE m_axi port=sharpened_output offset=slave bundle=gmem1
+#pragma HLS INTERFACE m_axi port=grayscale_output offset=slave bundle=gmem2
+#pragma HLS INTERFACE m_axi port=filtered_output offset=slave bundle=gmem3
+#pragma HLS INTERFACE m_axi port=stats offset=slave bundle=gmem4
+#pragma HLS INTERFACE s_axilite port=tap_grayscale
+#pragma HLS INTERFACE s_axilite port=tap_filtered
+#pragma HLS INTERFACE s_axilite port=width
+#pragma HLS INTERFACE s_axilite port=height
+#pragma HLS INTERFACE s_axilite port=first_row
+#pragma HLS INTERFACE s_axilite port=rows
+#pragma HLS INTERFACE s_axilite port=return
+    laplacian_sharpen_stats_band(input_image, sharpened_output, grayscale_output, filtered_output,
+                                 tap_grayscale, tap_filtered, width, height, first_row, rows, *stats);
+}
+
+void stencil_filter_top(ap_uint<8>* grayscale_output, ap_uint<8>* filtered_output, int width, int height) {
+#pragma HLS INTERFACE m_axi port=grayscale_output offset=slave bundle=gmem0
+#pragma HLS INTERFACE m_axi port=filtered_output offset=slave bundle=gmem1
+#pragma HLS INTERFACE s_axilite port=width
+#pragma HLS INTERFACE s_axilite port=height
+#pragma HLS INTERFACE s_axilite port=return
+    stencil_filter<FILTER_STENCIL>(grayscale_output, filtered_output, width, height);
+}
+
+void unsharp_top(ap_uint<8>* original_image, ap_uint<8>* filtered_output, ap_uint<8>* sharpened_output,
+                 int width, int height) {
+#pragma HLS INTERFACE m_axi port=original_image offset=slave bundle=gmem0
+#pragma HLS INTERFACE m_axi port=filtered_output offset=slave bundle=gmem1
+#pragma HLS INTERFACE m_axi port=sharpened_output offset=slave bundle=gmem2
+#pragma HLS INTERFACE s_axilite port=width
+#pragma HLS INTERFACE s_axilite port=height
+#pragma HLS INTERFACE s_axilite port=return
+    unsharp<unsharp_amount<UNSHARP_NUM, UNSHARP_SHIFT> >(original_image, filtered_output, sharpened_output,
+                                                         width, height);
+}
+
+// Wide-bus tops, WIDE_PIXELS pixels per clock. The frames are packed into
+// 512-bit words; see WIDE_WORDS().
+void grayscale_wide_top(wide_t* input_image, wide_t* output_image, int width, int height) {
+#pragma HLS INTERFACE m_axi port=input_image offset=slave bundle=gmem0 max_read_burst_length=64
+#pragma HLS INTERFACE m_axi port=output_image offset=slave bundle=gmem1 max_write_burst_length=64
+#pragma HLS INTERFACE s_axilite port=width
+#pragma HLS INTERFACE s_axilite port=height
+#pragma HLS INTERFACE s_axilite port=return
+    grayscale_wide<WIDE_PIXELS>(input_image, output_image, width, height);
+}
+
+void laplacian_wide_top(wide_t* grayscale_output, wide_t* filtered_output, int width, int height) {
+#pragma HLS INTERFACE m_axi port=grayscale_output offset=slave bundle=gmem0 max_read_burst_length=64
+#pragma HLS INTERFACE m_axi port=filtered_output offset=slave bundle=gmem1 max_write_burst_length=64
+#pragma HLS INTERFACE s_axilite port=width
+#pragma HLS INTERFACE s_axilite port=height
+#pragma HLS INTERFACE s_axilite port=return
+    laplacian_wide<WIDE_PIXELS>(grayscale_output, filtered_output, width, height);
+}
+
+void sharpen_wide_top(wide_t* original_image, wide_t* filtered_output, wide_t* sharpened_output,
+                      int width, int height) {
+#pragma HLS INTERFACE m_axi port=original_image offset=slave bundle=gmem0 max_read_burst_length=64
+#pragma HLS INTERFACE m_axi port=filtered_output offset=slave bundle=gmem1 max_read_burst_length=64
+#pragma HLS INTERFACE m_axi port=sharpened_output offset=slave bundle=gmem2 max_write_burst_length=64
+#pragma HLS INTERFACE s_axilite port=width
+#pragma HLS INTERFACE s_axilite port=height
+#pragma HLS INTERFACE s_axilite port=return
+    sharpen_wide<WIDE_PIXELS>(original_image, filtered_output, sharpened_output, width, height);
+}
+#endif
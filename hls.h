@@ -0,0 +1,165 @@
+#ifndef HLS_H
+#define HLS_H
+
+#include <stdint.h>
+#include "image_stats.h"
+#include "stencil.h"
+
+// Widest frame the line buffers are sized for (4K DCI). Only synthesis is
+// bound by it: HOST_ONLY builds size them from the frame.
+#define MAX_WIDTH 4096
+
+// Grayscale arithmetic, chosen at compile time with -DGRAYSCALE_MODE=<n>:
+//   GRAYSCALE_FLOAT        0.299f*r + 0.587f*g + 0.114f*b in single precision, truncated.
+//   GRAYSCALE_FIXED        coefficients scaled by 2^GRAYSCALE_FRAC_BITS, rounded to nearest (the default).
+//   GRAYSCALE_FLOAT_EXACT  integer only and bit-exact with GRAYSCALE_FLOAT. It emulates every float
+//                          rounding, which costs more than the float math; use it to check against FLOAT.
+#define GRAYSCALE_FLOAT 0
+#define GRAYSCALE_FIXED 1
+#define GRAYSCALE_FLOAT_EXACT 2
+
+#ifndef GRAYSCALE_MODE
+#define GRAYSCALE_MODE GRAYSCALE_FIXED
+#endif
+
+#ifndef GRAYSCALE_FRAC_BITS
+#define GRAYSCALE_FRAC_BITS 14
+#endif
+
+#define GRAYSCALE_FIXED_COEF(c) ((unsigned int)((c) * (1 << GRAYSCALE_FRAC_BITS) + 0.5))
+
+// The kernels are templates over the pixel type. hls.cpp instantiates them for
+// uint8_t, which is all a host build needs, and for ap_uint<8> unless HOST_ONLY
+// is defined. A HOST_ONLY build compiles with a plain C++ compiler and does not
+// need the Xilinx headers.
+
+// Kernel for grayscale conversion; input_image is packed 3 bytes per pixel.
+template <typename pixel_t>
+void grayscale(const pixel_t* input_image, pixel_t* output_image, int width, int height);
+
+// Kernel for Laplacian filtering; border pixels are written as zero.
+template <typename pixel_t>
+void laplacian(const pixel_t* grayscale_output, pixel_t* filtered_output, int width, int height);
+
+// Kernel for sharpening.
+template <typename pixel_t>
+void sharpen(const pixel_t* original_image, const pixel_t* filtered_output, pixel_t* sharpened_output,
+             int width, int height);
+
+// Any stencil from stencil.h, e.g. stencil_filter<laplacian8>. The outer
+// stencil_t::size / 2 pixels are written as zero. Unlike laplacian(), no
+// pixels inside the frame are masked. hls.cpp instantiates laplacian4,
+// laplacian8 and laplacian_of_gaussian5.
+template <typename stencil_t, typename pixel_t>
+void stencil_filter(const pixel_t* grayscale_output, pixel_t* filtered_output, int width, int height);
+
+// sharpen() with a compile-time amount, e.g. unsharp<unsharp_amount<3, 1> >
+// for 1.5. hls.cpp instantiates the amounts 1/2, 1, 3/2 and 2.
+template <typename amount_t, typename pixel_t>
+void unsharp(const pixel_t* original_image, const pixel_t* filtered_output, pixel_t* sharpened_output,
+             int width, int height);
+
+// Fused grayscale -> Laplacian -> sharpen. The grayscale and filtered frames
+// are written only when their tap is set.
+template <typename pixel_t>
+void laplacian_sharpen(const pixel_t* input_image, pixel_t* sharpened_output,
+                       pixel_t* grayscale_output, pixel_t* filtered_output,
+                       bool tap_grayscale, bool tap_filtered, int width, int height);
+
+// laplacian_sharpen() on rows first_row .. first_row + rows - 1 of the frame
+// only. The outputs are identical to those rows of a whole-frame run, so
+// replicated units can each take a band of the same frame (see
+// band_scheduler.h).
+template <typename pixel_t>
+void laplacian_sharpen_band(const pixel_t* input_image, pixel_t* sharpened_output,
+                            pixel_t* grayscale_output, pixel_t* filtered_output,
+                            bool tap_grayscale, bool tap_filtered, int width, int height,
+                            int first_row, int rows);
+
+// laplacian_sharpen() that also fills stats for the frame as it streams
+// through: the grayscale histogram, the sums of the filtered frame and the
+// pixels sharpen clips. No frame is read a second time.
+template <typename pixel_t>
+void laplacian_sharpen_stats(const pixel_t* input_image, pixel_t* sharpened_output,
+                             pixel_t* grayscale_output, pixel_t* filtered_output,
+                             bool tap_grayscale, bool tap_filtered, int width, int height, image_stats& stats);
+
+// The same for one band; stats covers the band's own rows only, and
+// image_stats_merge() of every band gives those of the whole frame.
+template <typename pixel_t>
+void laplacian_sharpen_stats_band(const pixel_t* input_image, pixel_t* sharpened_output,
+                                  pixel_t* grayscale_output, pixel_t* filtered_output,
+                                  bool tap_grayscale, bool tap_filtered, int width, int height,
+                                  int first_row, int rows, image_stats& stats);
+
+#ifndef HOST_ONLY
+#include <ap_int.h>
+
+// Synthesis top functions (set_top one of these). Templates cannot be tops,
+// so each wraps the ap_uint<8> instantiation and carries its interface pragmas.
+void grayscale_top(ap_uint<8>* input_image, ap_uint<8>* output_image, int width, int height);
+void laplacian_top(ap_uint<8>* grayscale_output, ap_uint<8>* filtered_output, int width, int height);
+void sharpen_top(ap_uint<8>* original_image, ap_uint<8>* filtered_output, ap_uint<8>* sharpened_output,
+                 int width, int height);
+void laplacian_sharpen_top(ap_uint<8>* input_image, ap_uint<8>* sharpened_output,
+                           ap_uint<8>* grayscale_output, ap_uint<8>* filtered_output,
+                           bool tap_grayscale, bool tap_filtered, int width, int height);
+// Instantiate it K times (v++ --connectivity.nk=laplacian_sharpen_band_top:K)
+// for K compute units.
+void laplacian_sharpen_band_top(ap_uint<8>* input_image, ap_uint<8>* sharpened_output,
+                                ap_uint<8>* grayscale_output, ap_uint<8>* filtered_output,
+                                bool tap_grayscale, bool tap_filtered, int width, int height,
+                                int first_row, int rows);
+// laplacian_sharpen_top() and laplacian_sharpen_band_top() that also write
+// the frame's (or band's) image_stats.
+void laplacian_sharpen_stats_top(ap_uint<8>* input_image, ap_uint<8>* sharpened_output,
+                                 ap_uint<8>* grayscale_output, ap_uint<8>* filtered_output,
+                                 bool tap_grayscale, bool tap_filtered, int width, int height, image_stats* stats);
+void laplacian_sharpen_stats_band_top(ap_uint<8>* input_image, ap_uint<8>* sharpened_output,
+                                      ap_uint<8>* grayscale_output, ap_uint<8>* filtered_output,
+                                      bool tap_grayscale, bool tap_filtered, int width, int height,
+                                      int first_row, int rows, image_stats* stats);
+
+// Tops for stencil_filter() and unsharp(); the stencil and the amount are
+// picked when synthesising, e.g. -DFILTER_STENCIL=laplacian_of_gaussian5
+// -DUNSHARP_NUM=3 -DUNSHARP_SHIFT=1.
+#ifndef FILTER_STENCIL
+#define FILTER_STENCIL laplacian8
+#endif
+#ifndef UNSHARP_NUM
+#define UNSHARP_NUM 1
+#endif
+#ifndef UNSHARP_SHIFT
+#define UNSHARP_SHIFT 0
+#endif
+void stencil_filter_top(ap_uint<8>* grayscale_output, ap_uint<8>* filtered_output, int width, int height);
+void unsharp_top(ap_uint<8>* original_image, ap_uint<8>* filtered_output, ap_uint<8>* sharpened_output,
+                 int width, int height);
+
+// Wide-bus kernels: each frame is a byte array packed into 512-bit words (one
+// AXI beat, 64 bytes), padded with zeros to a whole word, and N pixels
+// (1, 2, 4, 8 or 16) are processed per clock. Results match the kernels above.
+typedef ap_uint<512> wide_t;
+#define WIDE_BYTES 64
+#define WIDE_WORDS(bytes) (((bytes) + WIDE_BYTES - 1) / WIDE_BYTES)
+
+// Pixels per clock of the *_wide_top functions.
+#ifndef WIDE_PIXELS
+#define WIDE_PIXELS 8
+#endif
+
+template <int N>
+void grayscale_wide(const wide_t* input_image, wide_t* output_image, int width, int height);
+template <int N>
+void laplacian_wide(const wide_t* grayscale_output, wide_t* filtered_output, int width, int height);
+template <int N>
+void sharpen_wide(const wide_t* original_image, const wide_t* filtered_output, wide_t* sharpened_output,
+                  int width, int height);
+
+void grayscale_wide_top(wide_t* input_image, wide_t* output_image, int width, int height);
+void laplacian_wide_top(wide_t* grayscale_output, wide_t* filtered_output, int width, int height);
+void sharpen_wide_top(wide_t* original_image, wide_t* filtered_output, wide_t* sharpened_output,
+                      int width, int height);
+#endif
+
+#endif
@@ -0,0 +1,340 @@
+#include "job_ring.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bump when the layout below changes, so an old client refuses a new server.
+static const uint32_t JOB_RING_MAGIC = 0x4c50524e;  // "LPRN"
+static const uint32_t JOB_RING_VERSION = 1;
+static const size_t JOB_RING_PAGE = 4096;
+
+enum slot_state { SLOT_FREE, SLOT_CLAIMED, SLOT_SUBMITTED, SLOT_RUNNING, SLOT_DONE, SLOT_FAILED };
+
+// Everything below lives in the shared segment, so it holds no pointers:
+// slot data is found by offset from the start of the mapping.
+struct job_ring_header {
+    uint32_t magic, version;
+    uint32_t slot_count;
+    uint64_t max_pixels;
+    uint64_t slot_stride;  // bytes from one slot's data to the next
+    uint64_t data_offset;  // first slot's data from the start of the mapping
+    sem_t free_slots;      // counts slots a client can claim
+    sem_t submitted;       // counts jobs waiting for the server
+    std::atomic<uint64_t> next_sequence;
+    std::atomic<uint32_t> stopping;
+};
+
+struct job_slot {
+    std::atomic<uint32_t> state;
+    int32_t width, height;
+    uint64_t sequence;  // submission order
+    sem_t done;
+};
+
+// Input (3 bytes per pixel) and the three outputs, each page aligned.
+static size_t input_bytes(size_t max_pixels) {
+    return (max_pixels * 3 + JOB_RING_PAGE - 1) / JOB_RING_PAGE * JOB_RING_PAGE;
+}
+
+static size_t plane_bytes(size_t max_pixels) {
+    return (max_pixels + JOB_RING_PAGE - 1) / JOB_RING_PAGE * JOB_RING_PAGE;
+}
+
+static size_t table_bytes(int slots) {
+    size_t bytes = sizeof(job_ring_header) + slots * sizeof(job_slot);
+    return (bytes + JOB_RING_PAGE - 1) / JOB_RING_PAGE * JOB_RING_PAGE;
+}
+
+bool job_ring::create(const char* name, int slots, size_t max_pixels) {
+    close();
+    if (slots < 1 || max_pixels < 1) {
+        fprintf(stderr, "Error: a job ring needs at least one slot and one pixel\n");
+        return false;
+    }
+
+    size_t stride = input_bytes(max_pixels) + OUTPUT_COUNT * plane_bytes(max_pixels);
+    size_t size = table_bytes(slots) + slots * stride;
+
+    // A server that was killed leaves its segment behind; start afresh.
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "Error: could not create shared memory %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, size) != 0) {
+        fprintf(stderr, "Error: could not size shared memory %s to %zu bytes: %s\n", name, size, strerror(errno));
+        ::close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        fprintf(stderr, "Error: could not map shared memory %s: %s\n", name, strerror(errno));
+        shm_unlink(name);
+        return false;
+    }
+
+    job_ring_header* h = new (memory) job_ring_header;
+    h->slot_count = slots;
+    h->max_pixels = max_pixels;
+    h->slot_stride = stride;
+    h->data_offset = table_bytes(slots);
+    sem_init(&h->free_slots, 1, slots);
+    sem_init(&h->submitted, 1, 0);
+    h->next_sequence.store(0);
+    h->stopping.store(0);
+    job_slot* table = (job_slot*)(h + 1);
+    for (int i = 0; i < slots; i++) {
+        job_slot* s = new (&table[i]) job_slot;
+        s->state.store(SLOT_FREE);
+        s->width = s->height = 0;
+        s->sequence = 0;
+        sem_init(&s->done, 1, 0);
+    }
+    // Clients check the magic last, so they never see a half-built header.
+    h->version = JOB_RING_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    h->magic = JOB_RING_MAGIC;
+
+    header = h;
+    mapping = memory;
+    mapping_size = size;
+    owner = true;
+    snprintf(this->name, sizeof(this->name), "%s", name);
+    return true;
+}
+
+bool job_ring::open(const char* name) {
+    close();
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Error: could not open shared memory %s: %s (is the server running?)\n", name,
+                strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(job_ring_header)) {
+        fprintf(stderr, "Error: shared memory %s is not a job ring\n", name);
+        ::close(fd);
+        return false;
+    }
+    void* memory = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        fprintf(stderr, "Error: could not map shared memory %s: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    job_ring_header* h = (job_ring_header*)memory;
+    uint32_t magic = h->magic;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (magic != JOB_RING_MAGIC || h->version != JOB_RING_VERSION ||
+        h->data_offset + h->slot_count * h->slot_stride > (uint64_t)st.st_size) {
+        fprintf(stderr, "Error: shared memory %s is not a job ring of version %u\n", name, JOB_RING_VERSION);
+        munmap(memory, st.st_size);
+        return false;
+    }
+
+    header = h;
+    mapping = memory;
+    mapping_size = st.st_size;
+    owner = false;
+    snprintf(this->name, sizeof(this->name), "%s", name);
+    return true;
+}
+
+void job_ring::close() {
+    if (!mapping) {
+        return;
+    }
+    if (owner) {
+        // Clients still attached keep their mapping; the name goes now.
+        shm_unlink(name);
+    }
+    munmap(mapping, mapping_size);
+    header = NULL;
+    mapping = NULL;
+    mapping_size = 0;
+    owner = false;
+}
+
+int job_ring::slots() const {
+    return header ? header->slot_count : 0;
+}
+
+size_t job_ring::max_pixels() const {
+    return header ? header->max_pixels : 0;
+}
+
+job_slot* job_ring::slot_at(int slot) const {
+    return (job_slot*)(header + 1) + slot;
+}
+
+// Retries a semaphore wait interrupted by a signal, unless shutdown() was
+// what the signal did.
+static bool wait_semaphore(sem_t* semaphore, std::atomic<uint32_t>& stopping) {
+    while (sem_wait(semaphore) != 0) {
+        if (errno != EINTR || stopping.load()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int job_ring::claim() {
+    if (!wait_semaphore(&header->free_slots, header->stopping) || header->stopping.load()) {
+        return -1;
+    }
+    // The semaphore guarantees a free slot; another client may take the first
+    // one we see, so claim with compare-and-swap.
+    for (;;) {
+        for (uint32_t i = 0; i < header->slot_count; i++) {
+            uint32_t expected = SLOT_FREE;
+            if (slot_at(i)->state.compare_exchange_strong(expected, SLOT_CLAIMED)) {
+                return i;
+            }
+        }
+    }
+}
+
+unsigned char* job_ring::input(int slot) {
+    return (unsigned char*)mapping + header->data_offset + slot * header->slot_stride;
+}
+
+unsigned char* job_ring::output(int slot, output_plane which) {
+    return input(slot) + input_bytes(header->max_pixels) + which * plane_bytes(header->max_pixels);
+}
+
+const unsigned char* job_ring::result(int slot, output_plane which) const {
+    return const_cast<job_ring*>(this)->output(slot, which);
+}
+
+bool job_ring::submit(int slot, int width, int height) {
+    job_slot* s = slot_at(slot);
+    if (width < 1 || height < 1 || (size_t)width * height > header->max_pixels) {
+        fprintf(stderr, "Error: a %dx%d job does not fit a slot of %zu pixels\n", width, height, max_pixels());
+        return false;
+    }
+    s->width = width;
+    s->height = height;
+    s->sequence = header->next_sequence.fetch_add(1);
+    // The release store publishes the input and the fields above.
+    s->state.store(SLOT_SUBMITTED, std::memory_order_release);
+    sem_post(&header->submitted);
+    return true;
+}
+
+bool job_ring::wait(int slot, int timeout_ms) {
+    job_slot* s = slot_at(slot);
+    if (timeout_ms < 0) {
+        if (!wait_semaphore(&s->done, header->stopping)) {
+            return false;
+        }
+    } else {
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (sem_timedwait(&s->done, &deadline) != 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Timed out. Withdraw the job if the server has not taken it yet;
+            // otherwise it is running (or just finished) and owns the slot
+            // until it completes, so keep waiting for that.
+            uint32_t expected = SLOT_SUBMITTED;
+            if (s->state.compare_exchange_strong(expected, SLOT_FREE)) {
+                sem_post(&header->free_slots);
+                return false;
+            }
+            if (!wait_semaphore(&s->done, header->stopping)) {
+                return false;
+            }
+            break;
+        }
+    }
+    return s->state.load(std::memory_order_acquire) == SLOT_DONE;
+}
+
+void job_ring::release(int slot) {
+    // Only a slot the client holds goes back. One wait() withdrew is free
+    // already, and one the server is still running must not be handed out.
+    static const uint32_t held[] = {SLOT_CLAIMED, SLOT_DONE, SLOT_FAILED};
+    for (int i = 0; i < 3; i++) {
+        uint32_t expected = held[i];
+        if (slot_at(slot)->state.compare_exchange_strong(expected, SLOT_FREE, std::memory_order_release)) {
+            sem_post(&header->free_slots);
+            return;
+        }
+    }
+}
+
+int job_ring::next_job() {
+    // Oldest submission first. Every post follows a slot marked submitted,
+    // but the client may have withdrawn it since (see wait()), so a scan that
+    // finds nothing goes back to waiting.
+    for (;;) {
+        if (!wait_semaphore(&header->submitted, header->stopping) || header->stopping.load()) {
+            return -1;
+        }
+        int oldest = -1;
+        for (uint32_t i = 0; i < header->slot_count; i++) {
+            job_slot* s = slot_at(i);
+            if (s->state.load(std::memory_order_acquire) == SLOT_SUBMITTED &&
+                (oldest < 0 || s->sequence < slot_at(oldest)->sequence)) {
+                oldest = i;
+            }
+        }
+        // The client may withdraw it between the scan and here.
+        uint32_t expected = SLOT_SUBMITTED;
+        if (oldest >= 0 && slot_at(oldest)->state.compare_exchange_strong(expected, SLOT_RUNNING)) {
+            return oldest;
+        }
+    }
+}
+
+int job_ring::width(int slot) const {
+    return slot_at(slot)->width;
+}
+
+int job_ring::height(int slot) const {
+    return slot_at(slot)->height;
+}
+
+void job_ring::complete(int slot, bool ok) {
+    job_slot* s = slot_at(slot);
+    s->state.store(ok ? SLOT_DONE : SLOT_FAILED, std::memory_order_release);
+    sem_post(&s->done);
+}
+
+void job_ring::shutdown() {
+    if (!header) {
+        return;
+    }
+    header->stopping.store(1);
+    // Wake the server and any client blocked in claim(), and fail the jobs
+    // the server will not get to. The one it is running still completes.
+    sem_post(&header->submitted);
+    for (uint32_t i = 0; i < header->slot_count; i++) {
+        uint32_t expected = SLOT_SUBMITTED;
+        if (slot_at(i)->state.compare_exchange_strong(expected, SLOT_FAILED)) {
+            sem_post(&slot_at(i)->done);
+        }
+        sem_post(&header->free_slots);
+    }
+}
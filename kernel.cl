@@ -1,3 +1,60 @@
+// Grayscale arithmetic, chosen at build time with -DGRAYSCALE_MODE=<n>:
+//   GRAYSCALE_FLOAT        0.299f*r + 0.587f*g + 0.114f*b in single precision, truncated.
+//   GRAYSCALE_FIXED        coefficients scaled by 2^GRAYSCALE_FRAC_BITS, rounded to nearest (the default).
+//   GRAYSCALE_FLOAT_EXACT  integer only and bit-exact with GRAYSCALE_FLOAT. It emulates every float
+//                          rounding, which costs more than the float math; use it to check against FLOAT.
+#define GRAYSCALE_FLOAT 0
+#define GRAYSCALE_FIXED 1
+#define GRAYSCALE_FLOAT_EXACT 2
+
+#ifndef GRAYSCALE_MODE
+#define GRAYSCALE_MODE GRAYSCALE_FIXED
+#endif
+
+#ifndef GRAYSCALE_FRAC_BITS
+#define GRAYSCALE_FRAC_BITS 14
+#endif
+
+#define GRAYSCALE_FIXED_COEF(c) ((uint)((c) * (1 << GRAYSCALE_FRAC_BITS) + 0.5f))
+
+// 0.299f, 0.587f and 0.114f are exact multiples of 2^-27; these are their values at that scale.
+#define GRAYSCALE_EXACT_SHIFT 27
+#define GRAYSCALE_EXACT_R 40131100UL
+#define GRAYSCALE_EXACT_G 78785808UL
+#define GRAYSCALE_EXACT_B 15300821UL
+
+// Rounds a non-negative value held at 2^-27 scale to a 24-bit significand,
+// ties to even, as each single-precision multiply and add does.
+ulong round_to_float(ulong value) {
+    int bits = 64 - clz(value);
+    if (bits <= 24) {
+        return value;
+    }
+    int drop = bits - 24;
+    ulong half = 1UL << (drop - 1);
+    ulong rem = value & ((1UL << drop) - 1);
+    ulong q = value >> drop;
+    if (rem > half || (rem == half && (q & 1))) {
+        q++;
+    }
+    return q << drop;
+}
+
+uchar rgb_to_gray(uchar r, uchar g, uchar b) {
+#if GRAYSCALE_MODE == GRAYSCALE_FLOAT
+    return (uchar)(0.299f * r + 0.587f * g + 0.114f * b);
+#elif GRAYSCALE_MODE == GRAYSCALE_FIXED
+    uint sum = GRAYSCALE_FIXED_COEF(0.299f) * r + GRAYSCALE_FIXED_COEF(0.587f) * g +
+               GRAYSCALE_FIXED_COEF(0.114f) * b + (1u << (GRAYSCALE_FRAC_BITS - 1));
+    return (uchar)min(sum >> GRAYSCALE_FRAC_BITS, 255u);
+#else
+    // Same operation order as the float expression: (r + g) + b.
+    ulong sum = round_to_float(round_to_float(GRAYSCALE_EXACT_R * r) + round_to_float(GRAYSCALE_EXACT_G * g));
+    sum = round_to_float(sum + round_to_float(GRAYSCALE_EXACT_B * b));
+    return (uchar)(sum >> GRAYSCALE_EXACT_SHIFT);
+#endif
+}
+
 __kernel void grayscale(__global unsigned char* input_image, __global unsigned char* output_image, const int width, const int height) {
     int x = get_global_id(0);
     int y = get_global_id(1);
@@ -7,45 +64,73 @@ __kernel void grayscale(__global unsigned char* input_image, __global unsigned c
         unsigned char r = input_image[idx];
         unsigned char g = input_image[idx + 1];
         unsigned char b = input_image[idx + 2];
-        unsigned char gray = (unsigned char)(0.299f * r + 0.587f * g + 0.114f * b);
-        output_image[y * width + x] = gray;
+        output_image[y * width + x] = rgb_to_gray(r, g, b);
     }
 }
 
-__kernel void laplacian(
-    __global const uchar* grayscale_output,
-    __global uchar* padded,
-    __global uchar* filtered_output,
-    int width, int height) {
+// Work-group tile of the Laplacian, chosen at build time with
+// -DLAPLACIAN_TILE_X=<n> -DLAPLACIAN_TILE_Y=<n>. The host reads it back from
+// the compiled kernel and rounds the global size up to whole tiles.
+#ifndef LAPLACIAN_TILE_X
+#define LAPLACIAN_TILE_X 16
+#endif
 
-    int x = get_global_id(0);
-    int y = get_global_id(1);
-    int idx = y * width + x;
+#ifndef LAPLACIAN_TILE_Y
+#define LAPLACIAN_TILE_Y 16
+#endif
 
-    int padded_width = width + 2;
-    int padded_height = height + 2;
-    if (x < width && y < height) {
-        padded[(y + 1) * padded_width + (x + 1)] = grayscale_output[idx];
+// Row height-2 and column width-2 read as zero in the stencil: the old
+// padded-buffer version zeroed them by accident, and keeping them zero stays
+// bit-exact with its output.
+bool stencil_masked(int x, int y, int width, int height) {
+    return (y == height - 2 && x <= width - 2) || (x == width - 2 && y <= height - 2);
+}
+
+// Grayscale pixel as the stencil sees it; zero outside the image.
+uchar stencil_input(__global const uchar* grayscale_output, int x, int y, int width, int height) {
+    if (x < 0 || y < 0 || x >= width || y >= height || stencil_masked(x, y, width, height)) {
+        return 0;
     }
-    if (x == 0 || y == 0 || x == width - 1 || y == height - 1) {
-        padded[y * padded_width + x] = 0;
+    return grayscale_output[y * width + x];
+}
+
+// Each work-group copies its tile plus a one-pixel halo into local memory,
+// so every grayscale pixel is read from global memory about once.
+__kernel __attribute__((reqd_work_group_size(LAPLACIAN_TILE_X, LAPLACIAN_TILE_Y, 1)))
+void laplacian(
+    __global const uchar* restrict grayscale_output,
+    __global uchar* restrict filtered_output,
+    int width, int height) {
+
+    __local uchar tile[LAPLACIAN_TILE_Y + 2][LAPLACIAN_TILE_X + 2];
+
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+    int x0 = get_group_id(0) * LAPLACIAN_TILE_X - 1;
+    int y0 = get_group_id(1) * LAPLACIAN_TILE_Y - 1;
+
+    for (int i = ly * LAPLACIAN_TILE_X + lx; i < (LAPLACIAN_TILE_X + 2) * (LAPLACIAN_TILE_Y + 2);
+         i += LAPLACIAN_TILE_X * LAPLACIAN_TILE_Y) {
+        int tx = i % (LAPLACIAN_TILE_X + 2);
+        int ty = i / (LAPLACIAN_TILE_X + 2);
+        tile[ty][tx] = stencil_input(grayscale_output, x0 + tx, y0 + ty, width, height);
     }
 
-    barrier(CLK_GLOBAL_MEM_FENCE);
+    barrier(CLK_LOCAL_MEM_FENCE);
 
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= width || y >= height) {
+        return;
+    }
+
+    int filtered_value = 0;
     if (x > 0 && y > 0 && x < width - 1 && y < height - 1) {
-        int laplacian[3][3] = {{0, -1, 0}, {-1, 4, -1}, {0, -1, 0}};
-        int filtered_value = 0;
-        for (int ky = -1; ky <= 1; ky++) {
-            for (int kx = -1; kx <= 1; kx++) {
-                int pixel = padded[(y + ky + 1) * padded_width + (x + kx + 1)];
-                filtered_value += pixel * laplacian[ky + 1][kx + 1];
-            }
-        }
-        filtered_output[idx] = clamp(filtered_value, 0, 255);
-    } else {
-        filtered_output[idx] = 0;
+        filtered_value = 4 * tile[ly + 1][lx + 1]
+                       - tile[ly][lx + 1] - tile[ly + 2][lx + 1]
+                       - tile[ly + 1][lx] - tile[ly + 1][lx + 2];
     }
+    filtered_output[y * width + x] = clamp(filtered_value, 0, 255);
 }
 
 __kernel void sharpen(
@@ -61,3 +146,177 @@ __kernel void sharpen(
     int sharpened_value = original_image[idx] + filtered_output[idx];
     sharpened_output[idx] = clamp(sharpened_value, 0, 255);
 }
+
+// Widest frame the single work-item kernel's line buffers hold.
+#ifndef MAX_WIDTH
+#define MAX_WIDTH 4096
+#endif
+
+// Statistics the fused kernels gather on request; the same layout as
+// image_stats in image_stats.h.
+typedef struct {
+    uint histogram[256];        // grayscale values
+    ulong laplacian_sum;        // of the filtered frame, as written
+    ulong laplacian_sum_squares;
+    uint clipped;               // pixels where grayscale + Laplacian went past 255 in sharpen
+    uint pixels;
+} image_stats;
+
+// Grayscale, Laplacian and sharpen in one single work-item loop for the FPGA
+// flow: one RGB pixel in and, one row and one pixel later, one pixel of each
+// output per iteration. The two previous grayscale rows live in line buffers
+// and the 3x3 window in a shift register, so every input is read once.
+//
+// Only rows first_row .. first_row + rows - 1 are written. The loop also
+// streams the row above and below them, where the frame has one, so that
+// the window sees the same pixels as in a whole-frame run.
+//
+// Unless stats is null, the statistics of those rows are gathered on the way
+// and written to it at the end.
+void laplacian_sharpen_rows(
+    __global const uchar* restrict input_image,
+    __global uchar* restrict grayscale_output,
+    __global uchar* restrict filtered_output,
+    __global uchar* restrict sharpened_output,
+    int width, int height, int first_row, int rows,
+    __global image_stats* restrict stats) {
+
+    // Counted pixels go to alternate banks, as in grayscale_stage in hls.cpp,
+    // so a run of equal gray values never increments one bin on two
+    // iterations in a row and the loop keeps its II of 1.
+    uint histogram[2][256];
+    int bank = 0;
+    ulong laplacian_sum = 0;
+    ulong laplacian_sum_squares = 0;
+    uint clipped = 0;
+    if (stats) {
+        for (int i = 0; i < 256; i++) {
+            histogram[0][i] = 0;
+            histogram[1][i] = 0;
+        }
+    }
+
+    uchar line_buf[2][MAX_WIDTH];
+    uchar window[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+    int top = first_row > 0 ? first_row - 1 : 0;
+    int bottom = first_row + rows < height ? first_row + rows + 1 : height;
+
+    // One flattened loop over (bottom-top+1) x (width+1) positions; the extra
+    // row and column flush the window past the bottom and right edges.
+    int x = 0;
+    int y = top;
+    int total = (width + 1) * (bottom - top + 1);
+#ifdef INTELFPGA_CL
+    #pragma ivdep array(histogram) safelen(2)
+#endif
+    for (int i = 0; i < total; i++) {
+        uchar column[3] = {0, 0, 0};
+        if (y < bottom && x < width) {
+            int idx = y * width + x;
+            uchar gray = rgb_to_gray(input_image[idx * 3], input_image[idx * 3 + 1], input_image[idx * 3 + 2]);
+            if (y >= first_row && y < first_row + rows) {
+                grayscale_output[idx] = gray;
+                if (stats) {
+                    histogram[bank][gray]++;
+                    bank ^= 1;
+                }
+            }
+
+            column[0] = line_buf[0][x];
+            column[1] = line_buf[1][x];
+            column[2] = gray;
+            line_buf[0][x] = column[1];
+            line_buf[1][x] = gray;
+        } else if (x < width) {
+            // Flush row: the bottom row still has to reach the window centre
+            // for sharpen.
+            column[0] = line_buf[0][x];
+            column[1] = line_buf[1][x];
+        }
+
+        #pragma unroll
+        for (int ky = 0; ky < 3; ky++) {
+            window[ky][0] = window[ky][1];
+            window[ky][1] = window[ky][2];
+            window[ky][2] = column[ky];
+        }
+
+        // The window is centred on (cx, cy). It holds the real grayscale
+        // values; the compatibility mask is applied per tap.
+        if (y - 1 >= first_row && y - 1 < first_row + rows && x > 0) {
+            int cx = x - 1;
+            int cy = y - 1;
+            int filtered_value = 0;
+            if (cx > 0 && cy > 0 && cx < width - 1 && cy < height - 1) {
+                filtered_value = (stencil_masked(cx, cy, width, height) ? 0 : 4 * window[1][1])
+                               - (stencil_masked(cx, cy - 1, width, height) ? 0 : window[0][1])
+                               - (stencil_masked(cx, cy + 1, width, height) ? 0 : window[2][1])
+                               - (stencil_masked(cx - 1, cy, width, height) ? 0 : window[1][0])
+                               - (stencil_masked(cx + 1, cy, width, height) ? 0 : window[1][2]);
+            }
+            int filtered = clamp(filtered_value, 0, 255);
+            filtered_output[cy * width + cx] = filtered;
+            sharpened_output[cy * width + cx] = clamp(window[1][1] + filtered, 0, 255);
+            if (stats) {
+                laplacian_sum += filtered;
+                laplacian_sum_squares += filtered * filtered;
+                clipped += window[1][1] + filtered > 255;
+            }
+        }
+
+        if (++x > width) {
+            x = 0;
+            y++;
+        }
+    }
+
+    if (stats) {
+        for (int i = 0; i < 256; i++) {
+            stats->histogram[i] = histogram[0][i] + histogram[1][i];
+        }
+        stats->laplacian_sum = laplacian_sum;
+        stats->laplacian_sum_squares = laplacian_sum_squares;
+        stats->clipped = clipped;
+        stats->pixels = width * rows;
+    }
+}
+
+// stats may be null; the host passes a buffer only when it wants them.
+__kernel __attribute__((max_global_work_dim(0)))
+void laplacian_sharpen(
+    __global const uchar* restrict input_image,
+    __global uchar* restrict grayscale_output,
+    __global uchar* restrict filtered_output,
+    __global uchar* restrict sharpened_output,
+    int width, int height,
+    __global image_stats* restrict stats) {
+
+    laplacian_sharpen_rows(input_image, grayscale_output, filtered_output, sharpened_output, width, height, 0,
+                           height, stats);
+}
+
+// Compute units of laplacian_sharpen_band, chosen at build time with
+// -DLAPLACIAN_UNITS=<n>. The host cuts each image into several bands per
+// unit and deals them round-robin to one queue per unit; the runtime starts
+// each on a free unit. All of them share the frame buffers, since every band
+// writes only its own rows. Each band writes its own stats, which the host
+// merges.
+#ifndef LAPLACIAN_UNITS
+#define LAPLACIAN_UNITS 1
+#endif
+
+__kernel __attribute__((max_global_work_dim(0)))
+#ifdef INTELFPGA_CL
+__attribute__((num_compute_units(LAPLACIAN_UNITS)))
+#endif
+void laplacian_sharpen_band(
+    __global const uchar* restrict input_image,
+    __global uchar* restrict grayscale_output,
+    __global uchar* restrict filtered_output,
+    __global uchar* restrict sharpened_output,
+    int width, int height, int first_row, int rows,
+    __global image_stats* restrict stats) {
+
+    laplacian_sharpen_rows(input_image, grayscale_output, filtered_output, sharpened_output, width, height,
+                           first_row, rows, stats);
+}
@@ -1,58 +1,97 @@
 #define NOMINMAX // so that windows.h does not define min/max macros
 
 #include <algorithm>
+#include <csignal>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <time.h>
+#include <vector>
 #include "CL/opencl.h"
 #include "AOCLUtils/aocl_utils.h"
 #include "defines.h"
 #include "utils.h"
+#include "cl_pipeline.h"
+#include "profile.h"
+#include "job_ring.h"
 
 using namespace aocl_utils;
 
-#define WIDTH 321
-#define HEIGHT 481
-
 // OpenCL Global Variables.
 cl_platform_id platform;
 cl_device_id device;
 cl_context context;
-cl_command_queue queue;
-cl_kernel kernels[3]; // Grayscale, Laplacian, Sharpen
 cl_program program;
+cl_pipeline *pipeline = NULL;
 
-enum {GRAYSCALE_KERNEL, LAPLACIAN_KERNEL, SHARPEN_KERNEL};
-
-// Global variables.
-unsigned char *h_input = NULL;
-unsigned char *h_grayscale_output = NULL;
-unsigned char *h_filtered_output = NULL;
-unsigned char *h_sharpened_output = NULL;
-cl_mem input_buffer, grayscale_output_buffer, filtered_output_buffer, sharpened_output_buffer;
+// Global variables. One entry per input image.
+std::vector<unsigned char*> h_inputs;
+std::vector<unsigned char*> bmp_headers;
+std::vector<std::string> imageFilenames;
 
-std::string imageFilename;
 std::string aocxFilename;
+std::string clFilename;
+std::string platformName;
 std::string deviceInfo;
-unsigned char* bmp_header;
-int cols, rows;
-int width, height;
+int depth;
+int units;
+cl_pipeline::mode mode;
+bool collectStats;
+std::string profileJsonFilename;
+stage_profile profile;
+stage_profile* active_profile = NULL;
 char outputfile[256];
+std::string serveName;
+int serveSlots;
+size_t serveMaxPixels;
+job_ring ring;
+size_t servedJobs;
 
 // Function prototypes.
-void process_image();
 void initCL();
 void cleanup();
 void teardown(int exit_status = 1);
+void write_outputs(int index, const unsigned char* grayscale, const unsigned char* filtered,
+                   const unsigned char* sharpened);
+void serve();
+void print_profile();
 void print_usage();
 
 int main(int argc, char **argv) {
     // Parsing command line arguments.
     Options options(argc, argv);
 
-    // Relative path to image filename option.
+    // Relative paths to the images, separated by commas.
     if (options.has("img")) {
-        imageFilename = options.get<std::string>("img");
+        std::stringstream list(options.get<std::string>("img"));
+        std::string name;
+        while (std::getline(list, name, ',')) {
+            if (!name.empty())
+                imageFilenames.push_back(name);
+        }
+    }
+    // Resident mode: take jobs from a shared-memory ring instead of --img.
+    if (options.has("serve")) {
+        serveName = options.get<std::string>("serve");
+    }
+    if (options.has("slots")) {
+        serveSlots = options.get<int>("slots");
     } else {
+        serveSlots = 4;
+    }
+    serveMaxPixels = 3840 * 2160;
+    if (options.has("max-size")) {
+        int max_width, max_height;
+        std::string size = options.get<std::string>("max-size");
+        if (sscanf(size.c_str(), "%dx%d", &max_width, &max_height) != 2 || max_width < 1 || max_height < 1) {
+            std::cerr << "Error: bad size " << size << std::endl;
+            print_usage();
+            return 1;
+        }
+        serveMaxPixels = (size_t)max_width * max_height;
+    }
+
+    if (imageFilenames.empty() && serveName.empty()) {
         print_usage();
         return 0;
     }
@@ -64,151 +103,145 @@ int main(int argc, char **argv) {
         aocxFilename = "process_image";
     }
 
-    // Load the image.
-    bmp_header = (unsigned char*) malloc(BMP_HEADER_SIZE * sizeof(unsigned char));
-    if (!read_bmp(imageFilename.c_str(), bmp_header, (struct pixel**)&h_input)) {
-        std::cerr << "Error: could not load " << argv[1] << std::endl;
-        teardown(-1);
+    // Kernel source to build instead of loading an aocx.
+    if (options.has("cl")) {
+        clFilename = options.get<std::string>("cl");
+    }
+
+    // Platform name to search for; lets the host run on a CPU OpenCL runtime.
+    if (options.has("platform")) {
+        platformName = options.get<std::string>("platform");
+    } else {
+        platformName = "Intel(R) FPGA";
+    }
+
+    // Kernel flavour: separate NDRange kernels or the fused single work-item one.
+    mode = cl_pipeline::NDRANGE;
+    if (options.has("mode")) {
+        std::string name = options.get<std::string>("mode");
+        if (name == "fused") {
+            mode = cl_pipeline::FUSED;
+        } else if (name != "ndrange") {
+            std::cerr << "Error: unknown mode " << name << std::endl;
+            print_usage();
+            return 1;
+        }
     }
-    cols = *(int*)&bmp_header[18];
-    rows = *(int*)&bmp_header[22];
-    width = *(int*)&bmp_header[18];
-    height = *(int*)&bmp_header[22];
-    std::cout << "Input image dimensions: " << cols << "x" << rows << std::endl;
-
-    // Ensure the image dimensions are correct
-    if (cols != WIDTH || rows != HEIGHT) {
-        std::cerr << "Error: image should be " << WIDTH << "x" << HEIGHT << " pixels, but is actually " << cols << "x" << rows << std::endl;
-        teardown(-1);
+
+    // Number of images in flight when processing several.
+    if (options.has("depth")) {
+        depth = options.get<int>("depth");
+    } else {
+        depth = 3;
+    }
+
+    // Compute units of laplacian_sharpen_band to split each image across.
+    if (options.has("units")) {
+        units = options.get<int>("units");
+    } else {
+        units = 1;
+    }
+    if (units > 1 && mode != cl_pipeline::FUSED) {
+        std::cerr << "Error: --units needs --mode=fused" << std::endl;
+        print_usage();
+        return 1;
+    }
+
+    // Histogram and focus score, gathered inside the fused kernel.
+    collectStats = options.has("stats");
+    if (collectStats && mode != cl_pipeline::FUSED) {
+        std::cerr << "Error: --stats needs --mode=fused" << std::endl;
+        print_usage();
+        return 1;
+    }
+
+    // Per-stage timing report, as text and/or JSON.
+    if (options.has("profile")) {
+        active_profile = &profile;
+    }
+    if (options.has("profile-json")) {
+        profileJsonFilename = options.get<std::string>("profile-json");
+        active_profile = &profile;
+    }
+
+    // Load the images.
+    std::vector<cl_image> images(imageFilenames.size());
+    for (size_t i = 0; i < imageFilenames.size(); i++) {
+        unsigned char* header = (unsigned char*) malloc(BMP_HEADER_SIZE * sizeof(unsigned char));
+        unsigned char* input = NULL;
+        bmp_headers.push_back(header);
+        double read_start = get_wall_time();
+        if (!read_bmp(imageFilenames[i].c_str(), header, (struct pixel**)&input)) {
+            std::cerr << "Error: could not load " << imageFilenames[i] << std::endl;
+            teardown(-1);
+        }
+        h_inputs.push_back(input);
+        images[i].pixels = input;
+        images[i].width = *(int*)&header[18];
+        images[i].height = *(int*)&header[22];
+        std::cout << "Input image dimensions: " << images[i].width << "x" << images[i].height << std::endl;
+        if (mode == cl_pipeline::FUSED && images[i].width > cl_pipeline::FUSED_MAX_WIDTH) {
+            std::cerr << "Error: --mode=fused takes images up to " << cl_pipeline::FUSED_MAX_WIDTH
+                      << " pixels wide" << std::endl;
+            teardown(-1);
+        }
+        if (active_profile) {
+            size_t pixels = (size_t)images[i].width * images[i].height;
+            active_profile->add("read_bmp", get_wall_time() - read_start, pixels, pixels * 3);
+        }
     }
 
     // Initializing OpenCL and the kernels.
-    h_grayscale_output = (unsigned char*) alignedMalloc(sizeof(unsigned char) * rows * cols);
-    h_filtered_output = (unsigned char*) alignedMalloc(sizeof(unsigned char) * rows * cols);
-    h_sharpened_output = (unsigned char*) alignedMalloc(sizeof(unsigned char) * rows * cols);
     initCL();
+    pipeline = new cl_pipeline(context, device, program, mode, depth, units, collectStats);
+    pipeline->set_profile(active_profile);
+
+    if (!serveName.empty()) {
+        serve();
+        if (active_profile) {
+            print_profile();
+        }
+        teardown(0);
+    }
 
     // Start measuring process_image time.
     double start = get_wall_time();
 
-    // Call the process_image.
-    process_image();
+    // Run the images through the pipeline; each one is written out as soon
+    // as its results are back, while the next ones are still on the device.
+    if (images.size() == 1) {
+        pipeline->run(images[0].pixels, images[0].width, images[0].height);
+    } else {
+        pipeline->run_batch(&images[0], (int)images.size(), write_outputs);
+    }
 
     // Stop measuring the process_image time.
     double end = get_wall_time();
-    printf("TIME ELAPSED: %.2f ms\n", end - start);
+    printf("TIME ELAPSED: %.2f ms (%zu images)\n", end - start, images.size());
 
     // Write out the processed images.
-    snprintf(outputfile, 256, "%s_grayscale.bmp", imageFilename.c_str());
-    printf("Writing grayscale image to %s\n", outputfile);
-    write_bmp(outputfile, bmp_header, (struct pixel*)h_grayscale_output);
-
-    snprintf(outputfile, 256, "%s_filtered.bmp", imageFilename.c_str());
-    printf("Writing filtered image to %s\n", outputfile);
-    write_bmp(outputfile, bmp_header, (struct pixel*)h_filtered_output);
+    if (images.size() == 1) {
+        write_outputs(0, pipeline->grayscale(), pipeline->filtered(), pipeline->sharpened());
+    }
 
-    snprintf(outputfile, 256, "%s_sharpened.bmp", imageFilename.c_str());
-    printf("Writing sharpened image to %s\n", outputfile);
-    write_bmp(outputfile, bmp_header, (struct pixel*)h_sharpened_output);
+    if (active_profile) {
+        print_profile();
+    }
 
     // Teardown OpenCL.
     teardown(0);
 }
 
-void process_image() {
-    cl_int status;
-
-    // SETUP KERNEL ARGUMENTS AND BUFFERS
-    input_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(unsigned char) * rows * cols * 3, NULL, &status); // 3 channels for RGB
-    checkError(status, "Error: could not create input_buffer");
-    grayscale_output_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(unsigned char) * rows * cols, NULL, &status);
-    checkError(status, "Error: could not create grayscale_output_buffer");
-    filtered_output_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(unsigned char) * rows * cols, NULL, &status);
-    checkError(status, "Error: could not create filtered_output_buffer");
-    sharpened_output_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(unsigned char) * rows * cols, NULL, &status);
-    checkError(status, "Error: could not create sharpened_output_buffer");
-
-    // Copy data to kernel input buffer.
-    status = clEnqueueWriteBuffer(queue, input_buffer, CL_TRUE, 0, sizeof(unsigned char) * rows * cols * 3, h_input, 0, NULL, NULL);
-    checkError(status, "Error: could not copy data into device");
-
-    // Enqueue Grayscale Kernel
-    status = clSetKernelArg(kernels[GRAYSCALE_KERNEL], 0, sizeof(cl_mem), (void*)&input_buffer);
-    checkError(status, "Error: could not set grayscale kernel arg 0");
-    status = clSetKernelArg(kernels[GRAYSCALE_KERNEL], 1, sizeof(cl_mem), (void*)&grayscale_output_buffer);
-    checkError(status, "Error: could not set grayscale kernel arg 1");
-    status = clSetKernelArg(kernels[GRAYSCALE_KERNEL], 2, sizeof(int), &width);
-    checkError(status, "Error: could not set grayscale kernel arg 2");
-    status = clSetKernelArg(kernels[GRAYSCALE_KERNEL], 3, sizeof(int), &height);
-    checkError(status, "Error: could not set grayscale kernel arg 3");
-
-    size_t global_work_size[2] = {width, height};
-    status = clEnqueueNDRangeKernel(queue, kernels[GRAYSCALE_KERNEL], 2, NULL, global_work_size, NULL, 0, NULL, NULL);
-    checkError(status, "Error: failed to enqueue grayscale kernel");
-
-    status = clFinish(queue);
-    checkError(status, "Failed to finish");
-    // Enqueue Laplacian Kernel
-    status = clSetKernelArg(kernels[LAPLACIAN_KERNEL], 0, sizeof(cl_mem), (void*)&grayscale_output_buffer);
-    checkError(status, "Error: could not set laplacian kernel arg 0");
-    status = clSetKernelArg(kernels[LAPLACIAN_KERNEL], 1, sizeof(cl_mem), (void*)&filtered_output_buffer);
-    checkError(status, "Error: could not set laplacian kernel arg 1");
-    status = clSetKernelArg(kernels[LAPLACIAN_KERNEL], 2, sizeof(int), &width);
-    checkError(status, "Error: could not set laplacian kernel arg 2");
-    status = clSetKernelArg(kernels[LAPLACIAN_KERNEL], 3, sizeof(int), &height);
-    checkError(status, "Error: could not set laplacian kernel arg 3");
-
-    status = clEnqueueNDRangeKernel(queue, kernels[LAPLACIAN_KERNEL], 2, NULL, global_work_size, NULL, 0, NULL, NULL);
-    checkError(status, "Error: failed to enqueue laplacian kernel");
-
-    status = clFinish(queue);
-    checkError(status, "Failed to finish");
-
-    // Enqueue Sharpen Kernel
-    status = clSetKernelArg(kernels[SHARPEN_KERNEL], 0, sizeof(cl_mem), (void*)&grayscale_output_buffer);
-    checkError(status, "Error: could not set sharpen kernel arg 0");
-    status = clSetKernelArg(kernels[SHARPEN_KERNEL], 1, sizeof(cl_mem), (void*)&filtered_output_buffer);
-    checkError(status, "Error: could not set sharpen kernel arg 1");
-    status = clSetKernelArg(kernels[SHARPEN_KERNEL], 2, sizeof(cl_mem), (void*)&sharpened_output_buffer);
-    checkError(status, "Error: could not set sharpen kernel arg 2");
-    status = clSetKernelArg(kernels[SHARPEN_KERNEL], 3, sizeof(int), &width);
-    checkError(status, "Error: could not set sharpen kernel arg 3");
-    status = clSetKernelArg(kernels[SHARPEN_KERNEL], 4, sizeof(int), &height);
-    checkError(status, "Error: could not set sharpen kernel arg 4");
-
-    status = clEnqueueNDRangeKernel(queue, kernels[SHARPEN_KERNEL], 2, NULL, global_work_size, NULL, 0, NULL, NULL);
-    checkError(status, "Error: failed to enqueue sharpen kernel");
-
-    status = clFinish(queue);
-    checkError(status, "Failed to finish");
-
-    // Read output buffers from kernels.
-    status = clEnqueueReadBuffer(queue, grayscale_output_buffer, CL_TRUE, 0, sizeof(unsigned char) * rows * cols, h_grayscale_output, 0, NULL, NULL);
-    checkError(status, "Error: could not copy grayscale data from device");
-
-    status = clEnqueueReadBuffer(queue, filtered_output_buffer, CL_TRUE, 0, sizeof(unsigned char) * rows * cols, h_filtered_output, 0, NULL, NULL);
-    checkError(status, "Error: could not copy filtered data from device");
-
-    status = clEnqueueReadBuffer(queue, sharpened_output_buffer, CL_TRUE, 0, sizeof(unsigned char) * rows * cols, h_sharpened_output, 0, NULL, NULL);
-    checkError(status, "Error: could not copy sharpened data from device");
-}
-
 void initCL() {
     cl_int status;
 
-    // Start everything at NULL to help identify errors.
-    kernels[GRAYSCALE_KERNEL] = NULL;
-    kernels[LAPLACIAN_KERNEL] = NULL;
-    kernels[SHARPEN_KERNEL] = NULL;
-    queue = NULL;
-
     // Locate files via relative paths.
     if (!setCwdToExeDir()) {
         teardown();
     }
 
     // Get the OpenCL platform.
-    platform = findPlatform("Intel(R) FPGA");
+    platform = findPlatform(platformName.c_str());
     if (platform == NULL) {
         teardown();
     }
@@ -225,27 +258,29 @@ void initCL() {
     context = clCreateContext(0, 1, &device, &oclContextCallback, NULL, &status);
     checkError(status, "Error: could not create OpenCL context");
 
-    // Create the command queues for the kernels.
-    queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &status);
-
     // Create the program.
-    std::string binary_file = getBoardBinaryFile(aocxFilename.c_str(), device);
-    std::cout << "Using AOCX: " << binary_file << "\n";
-    program = createProgramFromBinary(context, binary_file.c_str(), &device, 1);
+    if (!clFilename.empty()) {
+        std::ifstream file(clFilename.c_str());
+        if (!file) {
+            std::cerr << "Error: could not open " << clFilename << std::endl;
+            teardown();
+        }
+        std::stringstream source;
+        source << file.rdbuf();
+        std::string text = source.str();
+        const char* text_ptr = text.c_str();
+        std::cout << "Using CL source: " << clFilename << "\n";
+        program = clCreateProgramWithSource(context, 1, &text_ptr, NULL, &status);
+        checkError(status, "Error: could not create program from source");
+    } else {
+        std::string binary_file = getBoardBinaryFile(aocxFilename.c_str(), device);
+        std::cout << "Using AOCX: " << binary_file << "\n";
+        program = createProgramFromBinary(context, binary_file.c_str(), &device, 1);
+    }
 
     // Build the program that was just created.
     status = clBuildProgram(program, 1, &device, "", NULL, NULL);
     checkError(status, "Error: could not build program");
-
-    // Create the kernels - names must match kernel names in the original CL file.
-    kernels[GRAYSCALE_KERNEL] = clCreateKernel(program, "grayscale", &status);
-    checkError(status, "Failed to create grayscale kernel");
-
-    kernels[LAPLACIAN_KERNEL] = clCreateKernel(program, "laplacian", &status);
-    checkError(status, "Failed to create laplacian kernel");
-
-    kernels[SHARPEN_KERNEL] = clCreateKernel(program, "sharpen", &status);
-    checkError(status, "Failed to create sharpen kernel");
 }
 
 void cleanup() {
@@ -254,31 +289,13 @@ void cleanup() {
 }
 
 void teardown(int exit_status) {
-    if (kernels[GRAYSCALE_KERNEL])
-        clReleaseKernel(kernels[GRAYSCALE_KERNEL]);
-    if (kernels[LAPLACIAN_KERNEL])
-        clReleaseKernel(kernels[LAPLACIAN_KERNEL]);
-    if (kernels[SHARPEN_KERNEL])
-        clReleaseKernel(kernels[SHARPEN_KERNEL]);
-    if (queue)
-        clReleaseCommandQueue(queue);
-
-    if (h_input)
-        alignedFree(h_input);
-    if (h_grayscale_output)
-        alignedFree(h_grayscale_output);
-    if (h_filtered_output)
-        alignedFree(h_filtered_output);
-    if (h_sharpened_output)
-        alignedFree(h_sharpened_output);
-    if (input_buffer)
-        clReleaseMemObject(input_buffer);
-    if (grayscale_output_buffer)
-        clReleaseMemObject(grayscale_output_buffer);
-    if (filtered_output_buffer)
-        clReleaseMemObject(filtered_output_buffer);
-    if (sharpened_output_buffer)
-        clReleaseMemObject(sharpened_output_buffer);
+    if (pipeline)
+        delete pipeline;
+
+    for (size_t i = 0; i < h_inputs.size(); i++)
+        alignedFree(h_inputs[i]);
+    for (size_t i = 0; i < bmp_headers.size(); i++)
+        free(bmp_headers[i]);
     if (program)
         clReleaseProgram(program);
     if (context)
@@ -287,12 +304,133 @@ void teardown(int exit_status) {
     exit(exit_status);
 }
 
+void write_outputs(int index, const unsigned char* grayscale, const unsigned char* filtered,
+                   const unsigned char* sharpened) {
+    const char* name = imageFilenames[index].c_str();
+    unsigned char* header = bmp_headers[index];
+    double write_start = get_wall_time();
+
+    snprintf(outputfile, 256, "%s_grayscale.bmp", name);
+    printf("Writing grayscale image to %s\n", outputfile);
+    write_bmp(outputfile, header, (struct pixel*)grayscale);
+
+    snprintf(outputfile, 256, "%s_filtered.bmp", name);
+    printf("Writing filtered image to %s\n", outputfile);
+    write_bmp(outputfile, header, (struct pixel*)filtered);
+
+    snprintf(outputfile, 256, "%s_sharpened.bmp", name);
+    printf("Writing sharpened image to %s\n", outputfile);
+    write_bmp(outputfile, header, (struct pixel*)sharpened);
+
+    if (active_profile) {
+        size_t pixels = (size_t)*(int*)&header[18] * *(int*)&header[22];
+        active_profile->add("write_bmp", get_wall_time() - write_start, pixels, pixels * 3 * 3);
+    }
+
+    if (collectStats) {
+        const image_stats& stats = pipeline->stats();
+        double gray_sum = 0;
+        for (int i = 0; i < 256; i++) {
+            gray_sum += (double)i * stats.histogram[i];
+        }
+        printf("%s: focus %.2f (Laplacian variance), mean gray %.1f, %u of %u pixels clipped by sharpen\n", name,
+               laplacian_variance(stats), stats.pixels ? gray_sum / stats.pixels : 0.0, stats.clipped, stats.pixels);
+    }
+}
+
+static void stop_serving(int) {
+    ring.shutdown();
+}
+
+// Serves jobs until SIGINT or SIGTERM. Set up once, the pipeline reads each
+// job's pixels from the ring and writes the results back into it, so a job
+// costs its transfers and kernels and nothing else.
+void serve() {
+    if (!ring.create(serveName.c_str(), serveSlots, serveMaxPixels)) {
+        teardown();
+    }
+    signal(SIGINT, stop_serving);
+    signal(SIGTERM, stop_serving);
+    printf("Serving %s on %s: %d slots of up to %zu pixels\n", deviceInfo.c_str(), serveName.c_str(),
+           ring.slots(), ring.max_pixels());
+    fflush(stdout);
+
+    double busy_ms = 0;
+    for (int slot; (slot = ring.next_job()) >= 0; servedJobs++) {
+        double job_start = get_wall_time();
+        // The size comes from shared memory a client can still write, so
+        // check it again here rather than trust submit().
+        int width = ring.width(slot), height = ring.height(slot);
+        if (width < 1 || height < 1 || (size_t)width * height > ring.max_pixels() ||
+            width > pipeline->max_width()) {
+            ring.complete(slot, false);
+            continue;
+        }
+        pipeline->run_direct(ring.input(slot), width, height, ring.output(slot, job_ring::GRAYSCALE),
+                             ring.output(slot, job_ring::FILTERED), ring.output(slot, job_ring::SHARPENED));
+        ring.complete(slot, true);
+        busy_ms += get_wall_time() - job_start;
+    }
+    ring.close();
+    printf("Served %zu jobs, %.2f ms each on average\n", servedJobs, servedJobs ? busy_ms / servedJobs : 0.0);
+}
+
+void print_profile() {
+    // Device stages come from OpenCL profiling events, read_bmp and write_bmp
+    // from the host clock.
+    printf("\nPROFILE (%s mode, %zu images):\n", mode == cl_pipeline::FUSED ? "fused" : "ndrange",
+           serveName.empty() ? imageFilenames.size() : servedJobs);
+    profile.print(std::cout);
+
+    if (!profileJsonFilename.empty()) {
+        std::ofstream json(profileJsonFilename.c_str());
+        if (!json) {
+            std::cerr << "Error: could not write " << profileJsonFilename << std::endl;
+            return;
+        }
+        profile.write_json(json);
+        printf("Writing profile to %s\n", profileJsonFilename.c_str());
+    }
+}
+
 void print_usage() {
     printf("\nUsage:\n");
-    printf("\tprocess_image --img=<img> [--aocx=<aocx file>]\n\n");
+    printf("\tprocess_image --img=<img>[,<img>...] [--aocx=<aocx file>] [--cl=<cl file>] [--platform=<name>]\n");
+    printf("\t              [--mode=ndrange|fused] [--units=<n>] [--depth=<n>] [--stats] [--profile]\n");
+    printf("\t              [--profile-json=<file>]\n");
+    printf("\tprocess_image --serve=<name> [--slots=<n>] [--max-size=<W>x<H>] [same kernel options]\n\n");
     printf("Options:\n\n");
-    printf("--img=<img>\n");
-    printf("\tThe relative path to the input image to be processed.\n\n");
+    printf("--img=<img>[,<img>...]\n");
+    printf("\tThe relative path to the input image to be processed. Several comma-separated\n");
+    printf("\timages are processed as one batch, overlapping transfers with compute.\n\n");
     printf("[--aocx=<aocx file>]\n");
     printf("\tThe relative path to the aocx file without the .aocx suffix (default: process_image).\n\n");
+    printf("[--cl=<cl file>]\n");
+    printf("\tBuild the kernels from OpenCL source instead of loading an aocx.\n\n");
+    printf("[--platform=<name>]\n");
+    printf("\tUse the first platform whose name contains <name> (default: Intel(R) FPGA).\n");
+    printf("\tTogether with --cl this runs the host on a CPU OpenCL runtime, without a board.\n\n");
+    printf("[--mode=ndrange|fused]\n");
+    printf("\tRun the three NDRange kernels (default), or the single work-item laplacian_sharpen\n");
+    printf("\tkernel that produces all three outputs in one pass. Its line buffers take\n");
+    printf("\timages up to %d pixels wide (MAX_WIDTH in kernel.cl).\n\n", cl_pipeline::FUSED_MAX_WIDTH);
+    printf("[--units=<n>]\n");
+    printf("\tWith --mode=fused, split each image into four row bands per unit, run on the <n>\n");
+    printf("\tcompute units of laplacian_sharpen_band (build the kernels with -DLAPLACIAN_UNITS=<n>).\n\n");
+    printf("[--depth=<n>]\n");
+    printf("\tNumber of images in flight in a batch (default: 3).\n\n");
+    printf("[--stats]\n");
+    printf("\tWith --mode=fused, gather the grayscale histogram, the Laplacian variance (focus\n");
+    printf("\tscore) and the pixels sharpen clips in the same pass, and print them per image.\n\n");
+    printf("[--profile]\n");
+    printf("\tPrint the time, MPix/s and bytes moved of every upload, kernel and download.\n\n");
+    printf("[--profile-json=<file>]\n");
+    printf("\tAlso write that report to <file> as JSON.\n\n");
+    printf("--serve=<name>\n");
+    printf("\tStay resident and process jobs from clients of the job_ring library, sent\n");
+    printf("\tthrough the POSIX shared memory <name> (e.g. /laplacian), until SIGINT or SIGTERM.\n\n");
+    printf("[--slots=<n>]\n");
+    printf("\tJobs the ring holds at once (default: 4).\n\n");
+    printf("[--max-size=<W>x<H>]\n");
+    printf("\tLargest image a job may carry (default: 3840x2160).\n\n");
 }
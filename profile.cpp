@@ -0,0 +1,53 @@
+#include "profile.h"
+
+#include <chrono>
+#include <cstdio>
+
+void stage_profile::add(const std::string& name, double ms, size_t pixels, size_t bytes) {
+    for (size_t i = 0; i < stages.size(); i++) {
+        if (stages[i].name == name) {
+            stages[i].calls++;
+            stages[i].ms += ms;
+            stages[i].pixels += pixels;
+            stages[i].bytes += bytes;
+            return;
+        }
+    }
+    stage s;
+    s.name = name;
+    s.calls = 1;
+    s.ms = ms;
+    s.pixels = pixels;
+    s.bytes = bytes;
+    stages.push_back(s);
+}
+
+void stage_profile::print(std::ostream& out) const {
+    char line[160];
+    snprintf(line, sizeof(line), "%-20s %6s %12s %10s %12s %10s\n", "stage", "calls", "ms", "MPix/s", "MB", "MB/s");
+    out << line;
+    for (size_t i = 0; i < stages.size(); i++) {
+        const stage& s = stages[i];
+        snprintf(line, sizeof(line), "%-20s %6d %12.3f %10.2f %12.3f %10.1f\n", s.name.c_str(), s.calls, s.ms,
+                 s.mpix_per_s(), s.bytes / 1e6, s.mb_per_s());
+        out << line;
+    }
+}
+
+void stage_profile::write_json(std::ostream& out) const {
+    char line[320];
+    out << "{\"stages\": [";
+    for (size_t i = 0; i < stages.size(); i++) {
+        const stage& s = stages[i];
+        snprintf(line, sizeof(line),
+                 "%s\n  {\"name\": \"%s\", \"calls\": %d, \"ms\": %.6f, \"pixels\": %zu, \"bytes\": %zu, "
+                 "\"mpix_per_s\": %.3f, \"mb_per_s\": %.3f}",
+                 i ? "," : "", s.name.c_str(), s.calls, s.ms, s.pixels, s.bytes, s.mpix_per_s(), s.mb_per_s());
+        out << line;
+    }
+    out << "\n]}\n";
+}
+
+double profile_now_ms() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,62 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Time, pixels and bytes moved per pipeline stage, summed over every call.
+// The OpenCL host fills it from profiling events and the testbench from CPU
+// timers, so both report the same way.
+class stage_profile {
+public:
+    struct stage {
+        std::string name;
+        int calls;
+        double ms;
+        size_t pixels;  // pixels processed
+        size_t bytes;   // bytes read plus bytes written
+
+        double mpix_per_s() const { return ms > 0 ? pixels / (ms * 1000.0) : 0; }
+        double mb_per_s() const { return ms > 0 ? bytes / (ms * 1000.0) : 0; }
+    };
+
+    // Adds one call of the named stage. Stages are reported in the order
+    // they were first added.
+    void add(const std::string& name, double ms, size_t pixels, size_t bytes);
+    void clear() { stages.clear(); }
+
+    const std::vector<stage>& entries() const { return stages; }
+
+    // One line per stage: calls, total ms, MPix/s, MB moved and MB/s.
+    void print(std::ostream& out) const;
+    // {"stages": [{"name": ..., "calls": ..., "ms": ..., ...}, ...]}
+    void write_json(std::ostream& out) const;
+
+private:
+    std::vector<stage> stages;
+};
+
+// Monotonic CPU clock in milliseconds.
+double profile_now_ms();
+
+// Adds the time from construction to destruction to profile as one call of
+// name. A null profile makes it a no-op.
+class stage_timer {
+public:
+    stage_timer(stage_profile* profile, const char* name, size_t pixels, size_t bytes)
+        : profile(profile), name(name), pixels(pixels), bytes(bytes), start(profile ? profile_now_ms() : 0) {}
+    ~stage_timer() {
+        if (profile)
+            profile->add(name, profile_now_ms() - start, pixels, bytes);
+    }
+
+private:
+    stage_profile* profile;
+    const char* name;
+    size_t pixels, bytes;
+    double start;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#include "band_scheduler.h"
+
+#include <algorithm>
+#include "profile.h"
+
+band_scheduler::band_scheduler(int units)
+    : pool(std::max(1, units)), bands_done(pool.size(), 0), busy_ms(pool.size(), 0) {}
+
+std::vector<frame_band> band_scheduler::plan(const int* heights, int count, int band_rows) const {
+    std::vector<frame_band> bands;
+    for (int i = 0; i < count; i++) {
+        int rows = band_rows;
+        if (rows <= 0) {
+            int pieces = count >= 2 * units() ? 1 : (4 * units() + count - 1) / count;
+            rows = (heights[i] + pieces - 1) / pieces;
+        }
+        rows = std::max(1, rows);
+        for (int y = 0; y < heights[i]; y += rows) {
+            frame_band band;
+            band.image = i;
+            band.first_row = y;
+            band.rows = std::min(rows, heights[i] - y);
+            bands.push_back(band);
+        }
+    }
+    return bands;
+}
+
+void band_scheduler::run(const std::vector<frame_band>& bands, const unit_fn& fn) {
+    pool.run((int)bands.size(), [&](int band, int unit) {
+        double start = profile_now_ms();
+        fn(unit, bands[band]);
+        busy_ms[unit] += profile_now_ms() - start;
+        bands_done[unit]++;
+    });
+}
@@ -0,0 +1,49 @@
+#ifndef BAND_SCHEDULER_H
+#define BAND_SCHEDULER_H
+
+#include <functional>
+#include <vector>
+#include "thread_pool.h"
+
+// Rows first_row .. first_row + rows - 1 of image `image` in a batch.
+struct frame_band {
+    int image;
+    int first_row, rows;
+};
+
+// Spreads bands of one or more frames across K replicated compute units,
+// such as K instances of laplacian_sharpen_band_top. A host thread drives
+// each unit: it hands its unit a band, waits for it, and takes the next one,
+// stealing from the other units' share once its own runs out, so a slow or
+// busy unit simply ends up with fewer bands. laplacian_sharpen_band() reads
+// the halo rows it needs itself, so the result is the same as one unit
+// running whole frames.
+class band_scheduler {
+public:
+    // Called from the thread of unit `unit` for every band it takes.
+    typedef std::function<void(int unit, const frame_band& band)> unit_fn;
+
+    explicit band_scheduler(int units);
+
+    int units() const { return pool.size(); }
+
+    // Cuts count images of the given heights into bands of band_rows rows.
+    // band_rows <= 0 keeps whole images when there are at least two per
+    // unit, and otherwise cuts each image into about four bands per unit, so
+    // there is something left to balance.
+    std::vector<frame_band> plan(const int* heights, int count, int band_rows = 0) const;
+
+    // Runs every band and returns once all of them are done.
+    void run(const std::vector<frame_band>& bands, const unit_fn& fn);
+
+    // Bands and busy milliseconds per unit, over every run() so far.
+    const std::vector<long>& unit_bands() const { return bands_done; }
+    const std::vector<double>& unit_busy_ms() const { return busy_ms; }
+
+private:
+    thread_pool pool;
+    std::vector<long> bands_done;
+    std::vector<double> busy_ms;
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include "bmpfunction.h"
+
+namespace {
+
+struct batch_image {
+    size_t index;
+    int width, height;
+    pooled_frame rgb;
+    pooled_frame gray, filtered, sharpened;
+};
+
+typedef std::unique_ptr<batch_image> image_ptr;
+
+// Queue of at most capacity images between two stages. push() blocks while
+// it is full and pop() while it is empty; once every producer has called
+// close(), pop() drains what is left and then returns false.
+class bounded_queue {
+public:
+    bounded_queue(int capacity, int producers, batch_queue_stats& stats)
+        : capacity(std::max(1, capacity)), producers(producers), stats(stats) {}
+
+    void push(image_ptr image) {
+        std::unique_lock<std::mutex> guard(lock);
+        if ((int)items.size() >= capacity) {
+            double start = profile_now_ms();
+            not_full.wait(guard, [this] { return (int)items.size() < capacity; });
+            stats.blocked_ms += profile_now_ms() - start;
+        }
+        items.push_back(std::move(image));
+        stats.pushes++;
+        stats.occupancy_sum += items.size();
+        stats.peak = std::max(stats.peak, (int)items.size());
+        not_empty.notify_one();
+    }
+
+    bool pop(image_ptr& image) {
+        std::unique_lock<std::mutex> guard(lock);
+        if (items.empty() && producers > 0) {
+            double start = profile_now_ms();
+            not_empty.wait(guard, [this] { return !items.empty() || producers == 0; });
+            stats.starved_ms += profile_now_ms() - start;
+        }
+        if (items.empty()) {
+            return false;
+        }
+        image = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        if (--producers == 0) {
+            not_empty.notify_all();
+        }
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable not_full, not_empty;
+    std::deque<image_ptr> items;
+    int capacity;
+    int producers;
+    batch_queue_stats& stats;
+};
+
+bool write_gray8(const std::string& filename, const pooled_frame& frame, int width, int height) {
+    BMPGray8Writer writer;
+    return writer.open(filename.c_str(), width, height, false) && writer.writeRows(frame.data(), height) &&
+           writer.close();
+}
+
+// "dir/name.bmp" -> "name".
+std::string stem(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+}  // namespace
+
+bool list_batch_inputs(const char* path, std::vector<std::string>& files) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Error: could not find %s\n", path);
+        return false;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        std::ifstream list(path);
+        if (!list) {
+            fprintf(stderr, "Error: could not read %s\n", path);
+            return false;
+        }
+        for (std::string line; std::getline(list, line);) {
+            if (!line.empty() && line[line.size() - 1] == '\r') {
+                line.erase(line.size() - 1);
+            }
+            if (!line.empty()) {
+                files.push_back(line);
+            }
+        }
+        return true;
+    }
+
+    DIR* dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "Error: could not open directory %s\n", path);
+        return false;
+    }
+    std::vector<std::string> found;
+    std::string prefix = std::string(path) + "/";
+    for (dirent* entry; (entry = readdir(dir)) != NULL;) {
+        size_t length = strlen(entry->d_name);
+        if (length > 4 && strcasecmp(entry->d_name + length - 4, ".bmp") == 0) {
+            found.push_back(prefix + entry->d_name);
+        }
+    }
+    closedir(dir);
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+    return true;
+}
+
+bool process_batch(const std::vector<std::string>& files, const batch_options& options, batch_stats& stats) {
+    int readers = std::max(1, options.readers);
+    int workers = options.workers > 0 ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+    int writers = std::max(1, options.writers);
+
+    bounded_queue decoded(options.queue_depth, readers, stats.decoded);
+    bounded_queue computed(options.queue_depth, workers, stats.computed);
+    std::atomic<size_t> next_file(0);
+    std::atomic<int> failed(0), written(0);
+    std::mutex profile_lock;
+    frame_pool frames(options.frames);
+    double start = profile_now_ms();
+
+    auto record = [&](const char* name, double since, size_t pixels, size_t bytes) {
+        double ms = profile_now_ms() - since;
+        std::lock_guard<std::mutex> guard(profile_lock);
+        stats.stages.add(name, ms, pixels, bytes);
+    };
+
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; r++) {
+        threads.push_back(std::thread([&] {
+            for (size_t i; (i = next_file++) < files.size();) {
+                double since = profile_now_ms();
+                BMPView view;
+                if (!mapBMP(files[i].c_str(), view)) {
+                    // mapBMP() has said why.
+                    failed++;
+                    continue;
+                }
+                image_ptr image(new batch_image);
+                image->index = i;
+                image->width = view.width;
+                image->height = view.height;
+                size_t pixels = (size_t)image->width * image->height;
+                size_t row_bytes = (size_t)image->width * 3;
+                image->rgb.acquire(frames, pixels * 3);
+                if (!image->rgb.data()) {
+                    unmapBMP(view);
+                    failed++;
+                    continue;
+                }
+                for (int y = 0; y < image->height; y++) {
+                    memcpy(image->rgb.data() + y * row_bytes, view.row(y), row_bytes);
+                }
+                unmapBMP(view);
+                record("read", since, pixels, pixels * 3);
+                decoded.push(std::move(image));
+            }
+            decoded.close();
+        }));
+    }
+    for (int w = 0; w < workers; w++) {
+        threads.push_back(std::thread([&] {
+            for (image_ptr image; decoded.pop(image);) {
+                double since = profile_now_ms();
+                int width = image->width, height = image->height;
+                size_t pixels = (size_t)width * height;
+                // Every pixel is written, so recycled buffers need no clearing.
+                image->gray.acquire(frames, pixels);
+                image->filtered.acquire(frames, pixels);
+                image->sharpened.acquire(frames, pixels);
+                if (!image->gray.data() || !image->filtered.data() || !image->sharpened.data()) {
+                    failed++;
+                    continue;
+                }
+                grayscale_simd(image->rgb.data(), image->gray.data(), width, height, options.level);
+                laplacian_simd(image->gray.data(), image->filtered.data(), width, height, options.level);
+                sharpen_simd(image->gray.data(), image->filtered.data(), image->sharpened.data(), width, height,
+                             options.level);
+                image->rgb.reset();
+                record("compute", since, pixels, pixels * (3 + 3));
+                computed.push(std::move(image));
+            }
+            computed.close();
+        }));
+    }
+    for (int w = 0; w < writers; w++) {
+        threads.push_back(std::thread([&] {
+            for (image_ptr image; computed.pop(image);) {
+                double since = profile_now_ms();
+                std::string base = options.output_dir + "/" + stem(files[image->index]);
+                if (write_gray8(base + "_grey.bmp", image->gray, image->width, image->height) &&
+                    write_gray8(base + "_laplacian.bmp", image->filtered, image->width, image->height) &&
+                    write_gray8(base + "_sharp.bmp", image->sharpened, image->width, image->height)) {
+                    written++;
+                } else {
+                    fprintf(stderr, "Error: could not write %s_*.bmp\n", base.c_str());
+                    failed++;
+                }
+                size_t pixels = (size_t)image->width * image->height;
+                record("write", since, pixels, pixels * 3);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+
+    stats.images = written;
+    stats.failed = failed;
+    stats.total_ms = profile_now_ms() - start;
+    stats.frames = frames.stats();
+    return failed == 0;
+}
@@ -0,0 +1,63 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+#include "frame_pool.h"
+#include "profile.h"
+#include "simd.h"
+
+struct batch_options {
+    std::string output_dir;  // <name>_grey.bmp, <name>_laplacian.bmp and <name>_sharp.bmp go here
+    int readers;             // threads reading and decoding BMPs
+    int workers;             // threads running the kernels; 0 means one per hardware thread
+    int writers;             // threads encoding and writing outputs
+    int queue_depth;         // images each queue holds before its producers block
+    simd_level level;        // kernel implementation
+    frame_pool_options frames;  // how the per-image buffers are backed
+
+    batch_options() : output_dir("."), readers(2), workers(0), writers(2), queue_depth(4), level(simd_best()) {}
+};
+
+// Occupancy of one queue between two stages, sampled on every push.
+struct batch_queue_stats {
+    long pushes;
+    double occupancy_sum;
+    int peak;
+    double blocked_ms;  // producers waiting for room
+    double starved_ms;  // consumers waiting for an image
+
+    batch_queue_stats() : pushes(0), occupancy_sum(0), peak(0), blocked_ms(0), starved_ms(0) {}
+    double mean_occupancy() const { return pushes ? occupancy_sum / pushes : 0; }
+};
+
+struct batch_stats {
+    int images;  // written
+    int failed;  // could not be read, given buffers or written
+    double total_ms;
+    batch_queue_stats decoded;   // reader -> kernels
+    batch_queue_stats computed;  // kernels -> writer
+    stage_profile stages;        // "read", "compute" and "write", summed over threads
+    frame_pool_stats frames;     // per-image buffers mapped and reused
+
+    batch_stats() : images(0), failed(0), total_ms(0) {}
+    double images_per_second() const { return total_ms > 0 ? images * 1000.0 / total_ms : 0; }
+};
+
+// The *.bmp files of a directory, sorted, or the non-empty lines of a list
+// file. Returns false (with a message) if path cannot be read.
+bool list_batch_inputs(const char* path, std::vector<std::string>& files);
+
+// Sharpens every file through three stages on their own threads: readers
+// decode BMPs, workers run grayscale -> Laplacian -> sharpen, and writers
+// encode the three 8-bit BMP outputs. The stages are joined by queues of
+// queue_depth images, so a slow stage holds the others back rather than
+// letting decoded frames pile up, and at most
+// readers + workers + writers + 2 * queue_depth images are in memory.
+// Their buffers come from a frame_pool, so once the pipeline has filled,
+// images of similar sizes reuse already-faulted memory.
+// Files that cannot be read or written are counted in stats.failed and
+// skipped. Returns false if any file failed.
+bool process_batch(const std::vector<std::string>& files, const batch_options& options, batch_stats& stats);
+
+#endif
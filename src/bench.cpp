@@ -0,0 +1,382 @@
+// Host benchmark: times every CPU implementation of the pipeline on
+// synthetic frames, stage by stage and end to end, and writes median and p99
+// per (implementation, size, stage) as JSON. Given a baseline written by an
+// earlier run it exits with status 1 if any median got slower than the
+// tolerance allows. Build with -DHOST_ONLY; see README.md.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "hls.h"
+#include "bmpfunction.h"
+#include "profile.h"
+#include "simd.h"
+#include "strip.h"
+#include "tiled.h"
+
+struct frame_size {
+    const char* name;
+    int width, height;
+};
+
+// Standard sizes, then odd widths whose BMP rows need padding.
+static const frame_size presets[] = {
+    {"qvga", 320, 240},
+    {"vga", 640, 480},
+    {"720p", 1280, 720},
+    {"1080p", 1920, 1080},
+    {"4k", 3840, 2160},
+    {"8k", 7680, 4320},
+    {"16k", 15360, 8640},
+    {"odd-321", 321, 481},
+    {"odd-1279", 1279, 719},
+    {"odd-3839", 3839, 2161},
+    {"odd-7681", 7681, 4321},
+};
+static const char* default_sizes = "qvga,vga,720p,1080p,4k,8k,odd-321,odd-1279,odd-3839,odd-7681";
+
+struct bench_options {
+    std::vector<frame_size> sizes;
+    std::vector<std::string> impls;
+    int warmup;
+    int reps;
+    std::string json;
+    std::string baseline;
+    double tolerance;  // allowed slowdown of a median, in percent
+    std::string scratch;
+
+    bench_options() : warmup(2), reps(10), json("bench.json"), tolerance(10), scratch(".") {}
+};
+
+struct result {
+    std::string impl, size, stage;
+    size_t pixels;
+    double median_ms, p99_ms;
+};
+
+static std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+static bool parse_size(const std::string& text, frame_size& size) {
+    for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+        if (text == presets[i].name) {
+            size = presets[i];
+            return true;
+        }
+    }
+    // Anything else must be WxH; the name then points into a leaked copy so
+    // it lives as long as the presets.
+    int width, height;
+    char extra;
+    if (sscanf(text.c_str(), "%dx%d%c", &width, &height, &extra) != 2 || width < 1 || height < 1) {
+        return false;
+    }
+    size.name = strdup(text.c_str());
+    size.width = width;
+    size.height = height;
+    return true;
+}
+
+// Pseudo-random RGB frame, the same for every run.
+static std::vector<uint8_t> synthetic_frame(int width, int height) {
+    std::vector<uint8_t> rgb((size_t)width * height * 3);
+    uint32_t state = 12345;
+    for (size_t i = 0; i < rgb.size(); i++) {
+        state = state * 1103515245 + 12345;
+        rgb[i] = state >> 24;
+    }
+    return rgb;
+}
+
+// Runs fn warmup + reps times and returns the sorted times of the reps.
+template <typename F>
+static std::vector<double> measure(const bench_options& options, F fn) {
+    std::vector<double> times;
+    for (int i = 0; i < options.warmup + options.reps; i++) {
+        double start = profile_now_ms();
+        fn();
+        double ms = profile_now_ms() - start;
+        if (i >= options.warmup)
+            times.push_back(ms);
+    }
+    std::sort(times.begin(), times.end());
+    return times;
+}
+
+// Nearest-rank percentile of sorted times.
+static double percentile(const std::vector<double>& times, double p) {
+    size_t rank = (size_t)(p / 100 * times.size() + 0.999999);
+    return times[std::min(times.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+static void add_result(std::vector<result>& results, const std::string& impl, const frame_size& size,
+                       const char* stage, const std::vector<double>& times) {
+    result r;
+    r.impl = impl;
+    r.size = size.name;
+    r.stage = stage;
+    r.pixels = (size_t)size.width * size.height;
+    r.median_ms = percentile(times, 50);
+    r.p99_ms = percentile(times, 99);
+    results.push_back(r);
+    printf("%-8s %-12s %-10s %12.3f %12.3f %10.1f\n", impl.c_str(), size.name, stage, r.median_ms, r.p99_ms,
+           r.pixels / (r.median_ms * 1000.0));
+    fflush(stdout);
+}
+
+static bool is_simd(const std::string& impl, simd_level& level) {
+    for (int l = SIMD_SCALAR; l <= SIMD_AVX2; l++) {
+        if (impl == simd_level_name(simd_level(l))) {
+            level = simd_level(l);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_impl(const bench_options& options, const std::string& impl, const frame_size& size,
+                     const std::vector<uint8_t>& rgb, std::vector<result>& results) {
+    int width = size.width, height = size.height;
+    size_t pixels = (size_t)width * height;
+    std::vector<uint8_t> gray(pixels), filtered(pixels), sharpened(pixels);
+    simd_level level;
+
+    if (is_simd(impl, level)) {
+        add_result(results, impl, size, "grayscale", measure(options, [&] {
+            grayscale_simd(rgb.data(), gray.data(), width, height, level);
+        }));
+        add_result(results, impl, size, "laplacian", measure(options, [&] {
+            laplacian_simd(gray.data(), filtered.data(), width, height, level);
+        }));
+        add_result(results, impl, size, "sharpen", measure(options, [&] {
+            sharpen_simd(gray.data(), filtered.data(), sharpened.data(), width, height, level);
+        }));
+        add_result(results, impl, size, "pipeline", measure(options, [&] {
+            grayscale_simd(rgb.data(), gray.data(), width, height, level);
+            laplacian_simd(gray.data(), filtered.data(), width, height, level);
+            sharpen_simd(gray.data(), filtered.data(), sharpened.data(), width, height, level);
+        }));
+    } else if (impl == "fused") {
+        add_result(results, impl, size, "pipeline", measure(options, [&] {
+            laplacian_sharpen(rgb.data(), sharpened.data(), gray.data(), filtered.data(), true, true, width,
+                              height);
+        }));
+    } else if (impl == "tiled") {
+        tiled_engine engine;
+        add_result(results, impl, size, "pipeline", measure(options, [&] {
+            engine.run(rgb.data(), sharpened.data(), gray.data(), filtered.data(), width, height);
+        }));
+    } else if (impl == "strip") {
+        // File to file, so this includes reading and writing padded BMP rows.
+        std::string input = options.scratch + "/bench_input.bmp";
+        std::string output = options.scratch + "/bench_sharpened.bmp";
+        writeBMP(input.c_str(), rgb, width, height);
+        add_result(results, impl, size, "pipeline", measure(options, [&] {
+            process_bmp_strips(input.c_str(), output.c_str(), NULL, NULL);
+        }));
+        remove(input.c_str());
+        remove(output.c_str());
+    }
+}
+
+static void write_json(const std::string& filename, const bench_options& options,
+                       const std::vector<result>& results) {
+    std::ofstream out(filename.c_str());
+    if (!out) {
+        std::cerr << "Error: could not write " << filename << std::endl;
+        return;
+    }
+    char line[320];
+    snprintf(line, sizeof(line), "{\"warmup\": %d, \"reps\": %d, \"results\": [", options.warmup, options.reps);
+    out << line;
+    for (size_t i = 0; i < results.size(); i++) {
+        const result& r = results[i];
+        // One result per line; read_baseline() relies on it.
+        snprintf(line, sizeof(line),
+                 "%s\n  {\"impl\": \"%s\", \"size\": \"%s\", \"stage\": \"%s\", \"pixels\": %zu, "
+                 "\"median_ms\": %.6f, \"p99_ms\": %.6f, \"mpix_per_s\": %.3f}",
+                 i ? "," : "", r.impl.c_str(), r.size.c_str(), r.stage.c_str(), r.pixels, r.median_ms, r.p99_ms,
+                 r.pixels / (r.median_ms * 1000.0));
+        out << line;
+    }
+    out << "\n]}\n";
+}
+
+// Value of "key": in a line of write_json() output.
+static bool field(const std::string& line, const char* key, std::string& value) {
+    std::string tag = std::string("\"") + key + "\": ";
+    size_t start = line.find(tag);
+    if (start == std::string::npos)
+        return false;
+    start += tag.size();
+    if (line[start] == '"') {
+        size_t end = line.find('"', start + 1);
+        value = line.substr(start + 1, end - start - 1);
+    } else {
+        value = line.substr(start, line.find_first_of(",}", start) - start);
+    }
+    return true;
+}
+
+static bool read_baseline(const std::string& filename, std::vector<result>& results) {
+    std::ifstream in(filename.c_str());
+    if (!in) {
+        std::cerr << "Error: could not read baseline " << filename << std::endl;
+        return false;
+    }
+    std::string line, median;
+    while (std::getline(in, line)) {
+        result r;
+        if (field(line, "impl", r.impl) && field(line, "size", r.size) && field(line, "stage", r.stage) &&
+            field(line, "median_ms", median)) {
+            r.pixels = 0;
+            r.median_ms = atof(median.c_str());
+            r.p99_ms = 0;
+            results.push_back(r);
+        }
+    }
+    return true;
+}
+
+// Prints every median that is more than tolerance percent slower than in
+// the baseline and returns how many there were.
+static int compare(const std::vector<result>& results, const std::vector<result>& baseline, double tolerance) {
+    int regressions = 0, compared = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        for (size_t j = 0; j < baseline.size(); j++) {
+            const result& r = results[i];
+            const result& b = baseline[j];
+            if (r.impl != b.impl || r.size != b.size || r.stage != b.stage)
+                continue;
+            compared++;
+            double change = (r.median_ms / b.median_ms - 1) * 100;
+            if (change > tolerance) {
+                printf("REGRESSION %-8s %-12s %-10s %10.3f ms -> %10.3f ms (%+.1f%%)\n", r.impl.c_str(),
+                       r.size.c_str(), r.stage.c_str(), b.median_ms, r.median_ms, change);
+                regressions++;
+            }
+        }
+    }
+    printf("Compared %d results against the baseline: %d slower by more than %.1f%%\n", compared, regressions,
+           tolerance);
+    return regressions;
+}
+
+static void print_usage() {
+    printf("\nUsage:\n");
+    printf("\tlaplacian_bench [--sizes=<size>[,<size>...]] [--impl=<impl>[,<impl>...]] [--warmup=<n>] [--reps=<n>]\n");
+    printf("\t                [--json=<file>] [--baseline=<file>] [--tolerance=<percent>] [--scratch=<dir>]\n\n");
+    printf("Options:\n\n");
+    printf("--sizes\tPresets (qvga, vga, 720p, 1080p, 4k, 8k, 16k, odd-321, odd-1279, odd-3839, odd-7681)\n");
+    printf("\tor WxH (default: %s).\n", default_sizes);
+    printf("--impl\tscalar, sse4.1, avx2, fused, tiled, strip (default: all the CPU supports).\n");
+    printf("--warmup\tUntimed runs before each measurement (default: 2).\n");
+    printf("--reps\tTimed runs per measurement (default: 10).\n");
+    printf("--json\tWhere to write the results (default: bench.json).\n");
+    printf("--baseline\tEarlier results to compare against; exit status 1 on a regression.\n");
+    printf("--tolerance\tAllowed median slowdown against the baseline, in percent (default: 10).\n");
+    printf("--scratch\tDirectory for the strip benchmark's BMP files (default: .).\n\n");
+}
+
+int main(int argc, char** argv) {
+    bench_options options;
+    std::string sizes = default_sizes;
+    std::string impls;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string key = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (key == "--sizes") {
+            sizes = value;
+        } else if (key == "--impl") {
+            impls = value;
+        } else if (key == "--warmup") {
+            options.warmup = atoi(value.c_str());
+        } else if (key == "--reps") {
+            options.reps = atoi(value.c_str());
+        } else if (key == "--json") {
+            options.json = value;
+        } else if (key == "--baseline") {
+            options.baseline = value;
+        } else if (key == "--tolerance") {
+            options.tolerance = atof(value.c_str());
+        } else if (key == "--scratch") {
+            options.scratch = value;
+        } else {
+            print_usage();
+            return key == "--help" ? 0 : 1;
+        }
+    }
+    if (options.reps < 1 || options.warmup < 0) {
+        std::cerr << "Error: --reps must be at least 1 and --warmup not negative" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> size_names = split(sizes);
+    for (size_t i = 0; i < size_names.size(); i++) {
+        frame_size size;
+        if (!parse_size(size_names[i], size)) {
+            std::cerr << "Error: unknown size " << size_names[i] << std::endl;
+            return 1;
+        }
+        options.sizes.push_back(size);
+    }
+
+    if (impls.empty()) {
+        for (int l = SIMD_SCALAR; l <= simd_best(); l++) {
+            options.impls.push_back(simd_level_name(simd_level(l)));
+        }
+        options.impls.push_back("fused");
+        options.impls.push_back("tiled");
+        options.impls.push_back("strip");
+    } else {
+        options.impls = split(impls);
+    }
+    for (size_t i = 0; i < options.impls.size(); i++) {
+        simd_level level;
+        const std::string& impl = options.impls[i];
+        bool known = impl == "fused" || impl == "tiled" || impl == "strip" || is_simd(impl, level);
+        if (!known || (is_simd(impl, level) && level > simd_best())) {
+            std::cerr << "Error: " << impl << " is unknown or not supported by this CPU" << std::endl;
+            return 1;
+        }
+    }
+
+    printf("%-8s %-12s %-10s %12s %12s %10s\n", "impl", "size", "stage", "median ms", "p99 ms", "MPix/s");
+    std::vector<result> results;
+    for (size_t s = 0; s < options.sizes.size(); s++) {
+        const frame_size& size = options.sizes[s];
+        std::vector<uint8_t> rgb = synthetic_frame(size.width, size.height);
+        for (size_t i = 0; i < options.impls.size(); i++) {
+            run_impl(options, options.impls[i], size, rgb, results);
+        }
+    }
+    write_json(options.json, options, results);
+    printf("Writing results to %s\n", options.json.c_str());
+
+    if (!options.baseline.empty()) {
+        std::vector<result> baseline;
+        if (!read_baseline(options.baseline, baseline)) {
+            return 1;
+        }
+        if (compare(results, baseline, options.tolerance) > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -2,7 +2,16 @@
 #include <fstream>
 #include <vector>
 #include <cstring>
-#include "ap_int.h"
+#include <cstdlib>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <climits>
+#include <cstdio>
+#include <unistd.h>
+#include "bmpfunction.h"
 
 using namespace std;
 
@@ -30,38 +39,114 @@ struct BMPInfoHeader {
     uint32_t colorsUsed{0};                // No. color indexes in the color table. Use 0 for the max number of colors allowed by bit_count
     uint32_t colorsImportant{0};           // No. of colors used for displaying the bitmap. If 0 all colors are required
 };
+
+// Header of an 8-bit BMP: the usual two headers plus a 256-entry gray palette.
+struct BMPGray8Header {
+    BMPHeader header;
+    BMPInfoHeader infoHeader;
+    uint8_t palette[256][4];
+};
 #pragma pack(pop)
 
-void readBMP(const char* filename, vector<ap_uint<8>>& data, int& width, int& height) {
-    ifstream inp{filename, ios_base::binary};
-    if (inp) {
-        BMPHeader header;
-        BMPInfoHeader infoHeader;
+// Where the pixel rows of a 24-bit BMP sit in the file.
+struct BMPLayout {
+    int width;
+    int height;
+    bool topDown;
+    size_t rowStride;
+    size_t offset;
+};
 
-        inp.read((char*)&header, sizeof(header));
-        inp.read((char*)&infoHeader, sizeof(infoHeader));
+// Checks the headers at the start of a fileSize-byte file and fills layout.
+// A negative height marks a top-down file.
+static bool parseBMP(const uint8_t* headers, size_t fileSize, BMPLayout& layout) {
+    BMPHeader header;
+    BMPInfoHeader infoHeader;
+    memcpy(&header, headers, sizeof(header));
+    memcpy(&infoHeader, headers + sizeof(header), sizeof(infoHeader));
 
-        width = infoHeader.width;
-        height = infoHeader.height;
+    layout.width = infoHeader.width;
+    // INT_MIN has no positive counterpart, so it is rejected below rather than negated.
+    layout.height = infoHeader.height == INT_MIN ? 0 : abs(infoHeader.height);
+    layout.topDown = infoHeader.height < 0;
+    layout.rowStride = ((size_t)layout.width * 3 + 3) & ~(size_t)3;
+    layout.offset = header.offsetData;
+    // The pixel bound is checked by division, so a huge header cannot wrap it.
+    if (header.fileType != 0x4D42 || infoHeader.bitCount != 24 || infoHeader.compression != 0 || layout.width <= 0 ||
+        layout.height == 0 || layout.offset > fileSize ||
+        (size_t)layout.height > (fileSize - layout.offset) / layout.rowStride) {
+        cerr << "Unsupported BMP file: only uncompressed 24-bit images are handled." << endl;
+        return false;
+    }
+    return true;
+}
 
-        size_t rowStride = (infoHeader.width * 3 + 3) & ~3;
-        vector<ap_uint<8>> tmpData(rowStride * infoHeader.height);
+bool mapBMP(const char* filename, BMPView& view) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error opening BMP file." << endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BMPHeader) + sizeof(BMPInfoHeader)) {
+        cerr << "Error reading BMP file." << endl;
+        close(fd);
+        return false;
+    }
+    void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        cerr << "Error mapping BMP file." << endl;
+        return false;
+    }
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
 
-        inp.seekg(header.offsetData, inp.beg);
-        inp.read((char*)tmpData.data(), tmpData.size());
+    const uint8_t* file = (const uint8_t*)mapping;
+    BMPLayout layout;
+    if (!parseBMP(file, st.st_size, layout)) {
+        munmap(mapping, st.st_size);
+        return false;
+    }
 
-        data.resize(infoHeader.width * infoHeader.height * 3);
-        for (int y = 0; y < infoHeader.height; ++y) {
-            for (int x = 0; x < infoHeader.width * 3; ++x) {
-                data[(y * infoHeader.width * 3) + x] = tmpData[(y * rowStride) + x];
-            }
-        }
+    // Rows are always exposed bottom-up, the order writeBMP stores them in.
+    unmapBMP(view);
+    view.width = layout.width;
+    view.height = layout.height;
+    if (!layout.topDown) {
+        view.pixels = file + layout.offset;
+        view.stride = layout.rowStride;
     } else {
-        cerr << "Error opening BMP file." << endl;
+        view.pixels = file + layout.offset + (layout.height - 1) * layout.rowStride;
+        view.stride = -(ptrdiff_t)layout.rowStride;
+    }
+    view.mapping = mapping;
+    view.mappingSize = st.st_size;
+    return true;
+}
+
+void unmapBMP(BMPView& view) {
+    if (view.mapping) {
+        munmap(view.mapping, view.mappingSize);
+    }
+    view = BMPView();
+}
+
+template <typename pixel_t>
+void readBMP(const char* filename, vector<pixel_t>& data, int& width, int& height) {
+    BMPView view;
+    if (mapBMP(filename, view)) {
+        width = view.width;
+        height = view.height;
+        data.resize((size_t)width * height * 3);
+        for (int y = 0; y < height; ++y) {
+            std::copy(view.row(y), view.row(y) + width * 3, data.begin() + (size_t)y * width * 3);
+        }
+        unmapBMP(view);
     }
 }
 
-void writeBMP(const char* filename, const vector<ap_uint<8>>& data, int width, int height) {
+template <typename pixel_t>
+void writeBMP(const char* filename, const vector<pixel_t>& data, int width, int height) {
     ofstream out{filename, ios_base::binary};
     if (out) {
         BMPHeader header;
@@ -81,7 +166,7 @@ void writeBMP(const char* filename, const vector<ap_uint<8>>& data, int width, i
         out.write((const char*)&header, sizeof(header));
         out.write((const char*)&infoHeader, sizeof(infoHeader));
 
-        vector<ap_uint<8>> tmpData(rowStride * height);
+        vector<uint8_t> tmpData(rowStride * height);
         for (int y = 0; y < height; ++y) {
             for (int x = 0; x < width * 3; ++x) {
                 tmpData[(y * rowStride) + x] = data[(y * width * 3) + x];
@@ -94,7 +179,8 @@ void writeBMP(const char* filename, const vector<ap_uint<8>>& data, int width, i
     }
 }
 
-void writeBMPGray(const char* filename, const vector<ap_uint<8>>& data, int width, int height) {
+template <typename pixel_t>
+void writeBMPGray(const char* filename, const vector<pixel_t>& data, int width, int height) {
     ofstream out{filename, ios_base::binary};
     if (out) {
         BMPHeader header;
@@ -114,10 +200,10 @@ void writeBMPGray(const char* filename, const vector<ap_uint<8>>& data, int widt
         out.write((const char*)&header, sizeof(header));
         out.write((const char*)&infoHeader, sizeof(infoHeader));
 
-        vector<ap_uint<8>> tmpData(rowStride * height);
+        vector<uint8_t> tmpData(rowStride * height);
         for (int y = 0; y < height; ++y) {
             for (int x = 0; x < width; ++x) {
-                ap_uint<8> pixel = data[y * width + x];
+                uint8_t pixel = data[y * width + x];
                 tmpData[(y * rowStride) + (x * 3)] = pixel;
                 tmpData[(y * rowStride) + (x * 3) + 1] = pixel;
                 tmpData[(y * rowStride) + (x * 3) + 2] = pixel;
@@ -129,3 +215,216 @@ void writeBMPGray(const char* filename, const vector<ap_uint<8>>& data, int widt
         cerr << "Error writing BMP file." << endl;
     }
 }
+
+// Returns the frame as bytes: in place when a pixel is one byte, otherwise
+// converted into storage.
+template <typename pixel_t>
+static const uint8_t* grayBytes(const vector<pixel_t>& data, vector<uint8_t>& storage) {
+    if (sizeof(pixel_t) == 1) {
+        return (const uint8_t*)data.data();
+    }
+    storage.assign(data.begin(), data.end());
+    return storage.data();
+}
+
+// Writes header followed by rows of an 8-bit frame to fd with writev(), taking
+// each row straight from pixels and padding it to rowStride bytes. reverse
+// emits the last row first.
+static bool writeRows(int fd, const void* header, size_t headerSize, const uint8_t* pixels, int width, int rows,
+                      size_t rowStride, bool reverse) {
+    static const uint8_t padding[4] = {0, 0, 0, 0};
+    size_t padBytes = rowStride - width;
+
+    vector<struct iovec> iov;
+    if (headerSize) {
+        iov.push_back({(void*)header, headerSize});
+    }
+    for (int i = 0; i <= rows; ++i) {
+        if (i < rows) {
+            int y = reverse ? rows - 1 - i : i;
+            iov.push_back({(void*)(pixels + (size_t)y * width), (size_t)width});
+            if (padBytes) {
+                iov.push_back({(void*)padding, padBytes});
+            }
+        }
+        if (iov.size() + 2 > IOV_MAX || (i == rows && !iov.empty())) {
+            // writev may stop short; resume from wherever it stopped.
+            size_t first = 0;
+            while (first < iov.size()) {
+                ssize_t written = writev(fd, &iov[first], std::min(iov.size() - first, (size_t)IOV_MAX));
+                if (written < 0) {
+                    return false;
+                }
+                while (first < iov.size() && (size_t)written >= iov[first].iov_len) {
+                    written -= iov[first].iov_len;
+                    ++first;
+                }
+                if (first < iov.size()) {
+                    iov[first].iov_base = (char*)iov[first].iov_base + written;
+                    iov[first].iov_len -= written;
+                }
+            }
+            iov.clear();
+        }
+    }
+    return true;
+}
+
+static bool writeGrayRows(const char* filename, const void* header, size_t headerSize, const uint8_t* pixels,
+                          int width, int height, size_t rowStride, bool topDown) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = writeRows(fd, header, headerSize, pixels, width, height, rowStride, topDown);
+    return close(fd) == 0 && ok;
+}
+
+// Header and palette of an 8-bit gray BMP; a negative height makes it top-down.
+static void fillGray8Header(BMPGray8Header& file, int width, int height) {
+    size_t rowStride = (width + 3) & ~3;
+
+    file.header.offsetData = sizeof(file);
+    file.header.fileSize = sizeof(file) + rowStride * abs(height);
+    file.infoHeader.size = sizeof(BMPInfoHeader);
+    file.infoHeader.width = width;
+    file.infoHeader.height = height;
+    file.infoHeader.bitCount = 8;
+    file.infoHeader.sizeImage = rowStride * abs(height);
+    file.infoHeader.colorsUsed = 256;
+    for (int i = 0; i < 256; ++i) {
+        file.palette[i][0] = file.palette[i][1] = file.palette[i][2] = i;
+        file.palette[i][3] = 0;
+    }
+}
+
+template <typename pixel_t>
+void writeBMPGray8(const char* filename, const vector<pixel_t>& data, int width, int height) {
+    BMPGray8Header file;
+    fillGray8Header(file, width, height);
+
+    vector<uint8_t> storage;
+    if (!writeGrayRows(filename, &file, sizeof(file), grayBytes(data, storage), width, height, (width + 3) & ~3,
+                       false)) {
+        cerr << "Error writing BMP file." << endl;
+    }
+}
+
+template <typename pixel_t>
+void writePGM(const char* filename, const vector<pixel_t>& data, int width, int height) {
+    char header[64];
+    int headerSize = snprintf(header, sizeof(header), "P5\n%d %d\n255\n", width, height);
+
+    vector<uint8_t> storage;
+    if (!writeGrayRows(filename, header, headerSize, grayBytes(data, storage), width, height, width, true)) {
+        cerr << "Error writing PGM file." << endl;
+    }
+}
+
+template <typename pixel_t>
+void writeRawY8(const char* filename, const vector<pixel_t>& data, int width, int height) {
+    vector<uint8_t> storage;
+    if (!writeGrayRows(filename, NULL, 0, grayBytes(data, storage), width, height, width, true)) {
+        cerr << "Error writing raw file." << endl;
+    }
+}
+
+BMPStripReader::~BMPStripReader() {
+    close();
+}
+
+bool BMPStripReader::open(const char* filename) {
+    close();
+    fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error opening BMP file." << endl;
+        return false;
+    }
+    uint8_t headers[sizeof(BMPHeader) + sizeof(BMPInfoHeader)];
+    struct stat st;
+    BMPLayout layout;
+    if (fstat(fd, &st) != 0 || pread(fd, headers, sizeof(headers), 0) != (ssize_t)sizeof(headers) ||
+        !parseBMP(headers, st.st_size, layout)) {
+        close();
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    width = layout.width;
+    height = layout.height;
+    topDown = layout.topDown;
+    rowStride = layout.rowStride;
+    offset = layout.offset;
+    return true;
+}
+
+bool BMPStripReader::readRows(int first, int count, uint8_t* rows) {
+    size_t size = rowStride * count;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = pread(fd, rows + done, size - done, offset + rowStride * first + done);
+        if (got <= 0) {
+            cerr << "Error reading BMP file." << endl;
+            return false;
+        }
+        done += got;
+    }
+    return true;
+}
+
+void BMPStripReader::close() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+}
+
+BMPGray8Writer::~BMPGray8Writer() {
+    close();
+}
+
+bool BMPGray8Writer::open(const char* filename, int width, int height, bool topDown) {
+    close();
+    this->width = width;
+    fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    BMPGray8Header file;
+    fillGray8Header(file, width, topDown ? -height : height);
+    if (fd < 0 || !::writeRows(fd, &file, sizeof(file), NULL, width, 0, 0, false)) {
+        cerr << "Error writing BMP file." << endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool BMPGray8Writer::writeRows(const uint8_t* rows, int count) {
+    if (!::writeRows(fd, NULL, 0, rows, width, count, (width + 3) & ~3, false)) {
+        cerr << "Error writing BMP file." << endl;
+        return false;
+    }
+    return true;
+}
+
+bool BMPGray8Writer::close() {
+    bool ok = true;
+    if (fd >= 0) {
+        ok = ::close(fd) == 0;
+    }
+    fd = -1;
+    return ok;
+}
+
+template void readBMP<uint8_t>(const char*, vector<uint8_t>&, int&, int&);
+template void writeBMP<uint8_t>(const char*, const vector<uint8_t>&, int, int);
+template void writeBMPGray<uint8_t>(const char*, const vector<uint8_t>&, int, int);
+template void writeBMPGray8<uint8_t>(const char*, const vector<uint8_t>&, int, int);
+template void writePGM<uint8_t>(const char*, const vector<uint8_t>&, int, int);
+template void writeRawY8<uint8_t>(const char*, const vector<uint8_t>&, int, int);
+
+#ifndef HOST_ONLY
+template void readBMP<ap_uint<8>>(const char*, vector<ap_uint<8>>&, int&, int&);
+template void writeBMP<ap_uint<8>>(const char*, const vector<ap_uint<8>>&, int, int);
+template void writeBMPGray<ap_uint<8>>(const char*, const vector<ap_uint<8>>&, int, int);
+template void writeBMPGray8<ap_uint<8>>(const char*, const vector<ap_uint<8>>&, int, int);
+template void writePGM<ap_uint<8>>(const char*, const vector<ap_uint<8>>&, int, int);
+template void writeRawY8<ap_uint<8>>(const char*, const vector<ap_uint<8>>&, int, int);
+#endif
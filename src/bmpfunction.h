@@ -0,0 +1,89 @@
+#ifndef BMPFUNCTION_H
+#define BMPFUNCTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#ifndef HOST_ONLY
+#include "ap_int.h"
+#endif
+
+// Read-only view of a 24-bit BMP mapped into memory. Rows are used in place:
+// row(y) points at the width*3 bytes of row y, bottom row first as in
+// readBMP, and stride is negative for top-down files.
+struct BMPView {
+    const uint8_t* pixels;
+    int width;
+    int height;
+    ptrdiff_t stride;
+    void* mapping;
+    size_t mappingSize;
+
+    BMPView() : pixels(NULL), width(0), height(0), stride(0), mapping(NULL), mappingSize(0) {}
+    const uint8_t* row(int y) const { return pixels + y * stride; }
+};
+
+// Maps filename and fills view; returns false (with a message) on failure.
+bool mapBMP(const char* filename, BMPView& view);
+void unmapBMP(BMPView& view);
+
+// Reads a 24-bit BMP a few rows at a time with pread(), so a frame never has
+// to fit in memory. Rows are numbered in file order: bottom row first unless
+// topDown. Each row read takes rowStride bytes (width*3 plus padding).
+class BMPStripReader {
+public:
+    int width;
+    int height;
+    bool topDown;
+    size_t rowStride;
+
+    BMPStripReader() : width(0), height(0), topDown(false), rowStride(0), fd(-1), offset(0) {}
+    ~BMPStripReader();
+
+    bool open(const char* filename);
+    bool readRows(int first, int count, uint8_t* rows);
+    void close();
+
+private:
+    int fd;
+    size_t offset;
+};
+
+// Writes an 8-bit gray BMP (see writeBMPGray8) a strip of rows at a time, in
+// file order. The header goes out on open, so the height must be known then.
+class BMPGray8Writer {
+public:
+    BMPGray8Writer() : fd(-1), width(0) {}
+    ~BMPGray8Writer();
+
+    bool open(const char* filename, int width, int height, bool topDown);
+    bool writeRows(const uint8_t* rows, int count);
+    bool close();
+
+private:
+    int fd;
+    int width;
+};
+
+// BMP handling functions, instantiated for uint8_t and (unless HOST_ONLY) ap_uint<8>.
+// Images are 24-bit, rows stored without padding; gray frames hold one byte per pixel.
+template <typename pixel_t>
+void readBMP(const char* filename, std::vector<pixel_t>& data, int& width, int& height);
+template <typename pixel_t>
+void writeBMP(const char* filename, const std::vector<pixel_t>& data, int width, int height);
+template <typename pixel_t>
+void writeBMPGray(const char* filename, const std::vector<pixel_t>& data, int width, int height);
+
+// Compact gray output. writeBMPGray8 stores 8 bits per pixel with a gray
+// palette (a third of writeBMPGray's size); writePGM and writeRawY8 write
+// binary PGM and headerless Y8 with the top row first. Rows go out with one
+// vectored write straight from data.
+template <typename pixel_t>
+void writeBMPGray8(const char* filename, const std::vector<pixel_t>& data, int width, int height);
+template <typename pixel_t>
+void writePGM(const char* filename, const std::vector<pixel_t>& data, int width, int height);
+template <typename pixel_t>
+void writeRawY8(const char* filename, const std::vector<pixel_t>& data, int width, int height);
+
+#endif
@@ -0,0 +1,123 @@
+#include "frame_pool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+
+static const size_t FRAME_PAGE = 4096;
+static const size_t FRAME_HUGE_PAGE = 2 << 20;
+
+frame_pool::frame_pool(const frame_pool_options& options) : options(options) {}
+
+frame_pool::~frame_pool() {
+    for (std::map<uint8_t*, mapping>::iterator it = mappings.begin(); it != mappings.end(); ++it) {
+        munmap(it->first, it->second.bytes);
+    }
+}
+
+size_t frame_pool::size_class(size_t bytes) {
+    size_t pages = (std::max<size_t>(bytes, 1) + FRAME_PAGE - 1) / FRAME_PAGE;
+    // Quarter steps between powers of two: 4, 5, 6, 7, 8, 10, 12, 14, 16, 20...
+    size_t top = 1;
+    while (top * 2 <= pages) {
+        top *= 2;
+    }
+    size_t step = std::max<size_t>(1, top / 4);
+    return (pages + step - 1) / step * step * FRAME_PAGE;
+}
+
+uint8_t* frame_pool::map(size_t size_class, mapping& mapped) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (options.populate) {
+        flags |= MAP_POPULATE;
+    }
+
+    void* memory = MAP_FAILED;
+    mapped.size_class = size_class;
+    if (options.pages == FRAME_PAGES_HUGETLB) {
+        mapped.bytes = (size_class + FRAME_HUGE_PAGE - 1) / FRAME_HUGE_PAGE * FRAME_HUGE_PAGE;
+        memory = mmap(NULL, mapped.bytes, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (memory == MAP_FAILED) {
+            // None reserved (vm.nr_hugepages) or not supported.
+            counters.huge_fallbacks++;
+        }
+    }
+    if (memory == MAP_FAILED) {
+        mapped.bytes = size_class;
+        memory = mmap(NULL, mapped.bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (memory == MAP_FAILED) {
+            fprintf(stderr, "Error: could not map a %zu byte frame: %s\n", mapped.bytes, strerror(errno));
+            return NULL;
+        }
+        if (options.pages != FRAME_PAGES_NORMAL) {
+            // Only a hint: without THP the buffer just keeps small pages.
+            madvise(memory, mapped.bytes, MADV_HUGEPAGE);
+        }
+    }
+    return (uint8_t*)memory;
+}
+
+void frame_pool::unmap(uint8_t* buffer, const mapping& mapped) {
+    munmap(buffer, mapped.bytes);
+    counters.mapped_bytes -= mapped.bytes;
+}
+
+uint8_t* frame_pool::acquire(size_t bytes) {
+    size_t size = size_class(bytes);
+    std::lock_guard<std::mutex> guard(lock);
+
+    std::map<size_t, std::vector<uint8_t*> >::iterator free = cached.find(size);
+    if (free != cached.end() && !free->second.empty()) {
+        uint8_t* buffer = free->second.back();
+        free->second.pop_back();
+        counters.reuses++;
+        counters.cached_bytes -= mappings[buffer].bytes;
+        return buffer;
+    }
+
+    mapping mapped;
+    uint8_t* buffer = map(size, mapped);
+    if (!buffer) {
+        return NULL;
+    }
+    mappings[buffer] = mapped;
+    counters.allocations++;
+    counters.mapped_bytes += mapped.bytes;
+    counters.peak_mapped_bytes = std::max(counters.peak_mapped_bytes, counters.mapped_bytes);
+    return buffer;
+}
+
+void frame_pool::release(uint8_t* buffer) {
+    if (!buffer) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<uint8_t*, mapping>::iterator it = mappings.find(buffer);
+    if (it == mappings.end()) {
+        fprintf(stderr, "Error: released a frame this pool did not hand out\n");
+        return;
+    }
+    cached[it->second.size_class].push_back(buffer);
+    counters.releases++;
+    counters.cached_bytes += it->second.bytes;
+}
+
+void frame_pool::trim() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (std::map<size_t, std::vector<uint8_t*> >::iterator free = cached.begin(); free != cached.end(); ++free) {
+        for (size_t i = 0; i < free->second.size(); i++) {
+            std::map<uint8_t*, mapping>::iterator it = mappings.find(free->second[i]);
+            unmap(it->first, it->second);
+            counters.cached_bytes -= it->second.bytes;
+            mappings.erase(it);
+        }
+    }
+    cached.clear();
+}
+
+frame_pool_stats frame_pool::stats() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return counters;
+}
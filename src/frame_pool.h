@@ -0,0 +1,119 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// How frame_pool backs its buffers.
+enum frame_pages {
+    FRAME_PAGES_NORMAL,       // 4 KiB pages
+    FRAME_PAGES_TRANSPARENT,  // ask for transparent huge pages with madvise(MADV_HUGEPAGE)
+    FRAME_PAGES_HUGETLB       // explicit 2 MiB huge pages (MAP_HUGETLB); falls back to transparent ones
+};
+
+struct frame_pool_options {
+    frame_pages pages;
+    bool populate;  // fault every page in when a buffer is first mapped, not on first use
+
+    frame_pool_options() : pages(FRAME_PAGES_TRANSPARENT), populate(false) {}
+};
+
+struct frame_pool_stats {
+    long allocations;   // buffers mapped from the system
+    long reuses;        // acquires served from a released buffer
+    long releases;
+    long huge_fallbacks;       // MAP_HUGETLB failed, so normal pages were used
+    size_t mapped_bytes;       // currently mapped, in use or cached
+    size_t peak_mapped_bytes;
+    size_t cached_bytes;       // released and waiting for reuse
+
+    frame_pool_stats()
+        : allocations(0), reuses(0), releases(0), huge_fallbacks(0), mapped_bytes(0), peak_mapped_bytes(0),
+          cached_bytes(0) {}
+};
+
+// Recycles frame buffers across images. Buffers are mapped directly with
+// mmap, so they start page aligned (4 KiB, or 2 MiB with MAP_HUGETLB, which
+// covers the 64 bytes the SIMD kernels and DMA want). They are never
+// zero-filled by the pool: a new mapping is zero because the kernel makes it
+// so, and a reused buffer keeps whatever the previous image left in it.
+//
+// Requests are rounded up to a size class (a power of two, or 1.25, 1.5 or
+// 1.75 times one, in whole pages), so frames of similar sizes share buffers
+// while wasting at most a fifth of each. Released buffers are cached per
+// class until trim() or destruction. All calls are thread-safe.
+class frame_pool {
+public:
+    explicit frame_pool(const frame_pool_options& options = frame_pool_options());
+    ~frame_pool();
+
+    // A buffer of at least bytes bytes, contents undefined.
+    uint8_t* acquire(size_t bytes);
+    // Gives a buffer from acquire() back for reuse.
+    void release(uint8_t* buffer);
+    // Unmaps every cached buffer.
+    void trim();
+
+    frame_pool_stats stats() const;
+
+    // Size class acquire(bytes) is served from.
+    static size_t size_class(size_t bytes);
+
+private:
+    frame_pool(const frame_pool&);
+    frame_pool& operator=(const frame_pool&);
+
+    struct mapping {
+        size_t size_class;
+        size_t bytes;  // as mapped; more than size_class with MAP_HUGETLB
+    };
+
+    uint8_t* map(size_t size_class, mapping& mapped);
+    void unmap(uint8_t* buffer, const mapping& mapped);
+
+    frame_pool_options options;
+    mutable std::mutex lock;
+    std::map<uint8_t*, mapping> mappings;             // every buffer, in use or cached
+    std::map<size_t, std::vector<uint8_t*> > cached;  // released buffers by size class
+    frame_pool_stats counters;
+};
+
+// A buffer from a frame_pool, given back when it goes out of scope.
+class pooled_frame {
+public:
+    pooled_frame() : pool(NULL), buffer(NULL), bytes(0) {}
+    pooled_frame(frame_pool& pool, size_t bytes) : pool(&pool), buffer(pool.acquire(bytes)), bytes(bytes) {}
+    ~pooled_frame() { reset(); }
+
+    uint8_t* data() const { return buffer; }
+    size_t size() const { return bytes; }
+
+    // Gives back any buffer held and takes one of size bytes from the pool.
+    void acquire(frame_pool& from, size_t size) {
+        reset();
+        pool = &from;
+        buffer = from.acquire(size);
+        bytes = buffer ? size : 0;
+    }
+
+    // Returns the buffer to its pool now.
+    void reset() {
+        if (buffer)
+            pool->release(buffer);
+        buffer = NULL;
+        bytes = 0;
+    }
+
+private:
+    pooled_frame(const pooled_frame&);
+    pooled_frame& operator=(const pooled_frame&);
+
+    frame_pool* pool;
+    uint8_t* buffer;
+    size_t bytes;
+};
+
+#endif
@@ -2,6 +2,63 @@
 #include <ap_int.h>
 #include <ap_axi_sdata.h>
 
+// Grayscale arithmetic, chosen at build time with -DGRAYSCALE_MODE=<n>:
+//   GRAYSCALE_FLOAT        0.299f*r + 0.587f*g + 0.114f*b in single precision, truncated.
+//   GRAYSCALE_FIXED        coefficients scaled by 2^GRAYSCALE_FRAC_BITS, rounded to nearest (the default).
+//   GRAYSCALE_FLOAT_EXACT  integer only and bit-exact with GRAYSCALE_FLOAT. It emulates every float
+//                          rounding, which costs more than the float math; use it to check against FLOAT.
+#define GRAYSCALE_FLOAT 0
+#define GRAYSCALE_FIXED 1
+#define GRAYSCALE_FLOAT_EXACT 2
+
+#ifndef GRAYSCALE_MODE
+#define GRAYSCALE_MODE GRAYSCALE_FIXED
+#endif
+
+#ifndef GRAYSCALE_FRAC_BITS
+#define GRAYSCALE_FRAC_BITS 14
+#endif
+
+#define GRAYSCALE_FIXED_COEF(c) ((uint)((c) * (1 << GRAYSCALE_FRAC_BITS) + 0.5f))
+
+// 0.299f, 0.587f and 0.114f are exact multiples of 2^-27; these are their values at that scale.
+#define GRAYSCALE_EXACT_SHIFT 27
+#define GRAYSCALE_EXACT_R 40131100UL
+#define GRAYSCALE_EXACT_G 78785808UL
+#define GRAYSCALE_EXACT_B 15300821UL
+
+// Rounds a non-negative value held at 2^-27 scale to a 24-bit significand,
+// ties to even, as each single-precision multiply and add does.
+ulong round_to_float(ulong value) {
+    int bits = 64 - clz(value);
+    if (bits <= 24) {
+        return value;
+    }
+    int drop = bits - 24;
+    ulong half = 1UL << (drop - 1);
+    ulong rem = value & ((1UL << drop) - 1);
+    ulong q = value >> drop;
+    if (rem > half || (rem == half && (q & 1))) {
+        q++;
+    }
+    return q << drop;
+}
+
+uchar rgb_to_gray(uchar r, uchar g, uchar b) {
+#if GRAYSCALE_MODE == GRAYSCALE_FLOAT
+    return (uchar)(0.299f * r + 0.587f * g + 0.114f * b);
+#elif GRAYSCALE_MODE == GRAYSCALE_FIXED
+    uint sum = GRAYSCALE_FIXED_COEF(0.299f) * r + GRAYSCALE_FIXED_COEF(0.587f) * g +
+               GRAYSCALE_FIXED_COEF(0.114f) * b + (1u << (GRAYSCALE_FRAC_BITS - 1));
+    return (uchar)min(sum >> GRAYSCALE_FRAC_BITS, 255u);
+#else
+    // Same operation order as the float expression: (r + g) + b.
+    ulong sum = round_to_float(round_to_float(GRAYSCALE_EXACT_R * r) + round_to_float(GRAYSCALE_EXACT_G * g));
+    sum = round_to_float(sum + round_to_float(GRAYSCALE_EXACT_B * b));
+    return (uchar)(sum >> GRAYSCALE_EXACT_SHIFT);
+#endif
+}
+
 // Kernel for grayscale conversion
 void grayscale(
 __global unsigned char* input_image, 
@@ -16,8 +73,7 @@ const int height)
             unsigned char r = input_image[idx];
             unsigned char g = input_image[idx + 1];
             unsigned char b = input_image[idx + 2];
-            unsigned char gray = (unsigned char)(0.299f * r + 0.587f * g + 0.114f * b);
-            output_image[y * width + x] = gray;
+            output_image[y * width + x] = rgb_to_gray(r, g, b);
         }
     }
 }
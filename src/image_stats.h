@@ -0,0 +1,45 @@
+#ifndef IMAGE_STATS_H
+#define IMAGE_STATS_H
+
+#include <stdint.h>
+
+// Statistics the fused kernels gather while they write a frame, so focus and
+// exposure checks need not read it back. Same layout as image_stats in
+// kernel.cl (1048 bytes), so the OpenCL kernels can write it directly.
+struct image_stats {
+    uint32_t histogram[256];         // grayscale values
+    uint64_t laplacian_sum;          // of the filtered frame, as written (0..255)
+    uint64_t laplacian_sum_squares;
+    uint32_t clipped;                // pixels where grayscale + Laplacian went past 255 in sharpen
+    uint32_t pixels;                 // pixels counted; width * rows for a band
+};
+
+static inline void image_stats_clear(image_stats& stats) {
+    for (int i = 0; i < 256; i++) {
+        stats.histogram[i] = 0;
+    }
+    stats.laplacian_sum = stats.laplacian_sum_squares = 0;
+    stats.clipped = stats.pixels = 0;
+}
+
+// Adds the statistics of another band of the same frame.
+static inline void image_stats_merge(image_stats& total, const image_stats& band) {
+    for (int i = 0; i < 256; i++) {
+        total.histogram[i] += band.histogram[i];
+    }
+    total.laplacian_sum += band.laplacian_sum;
+    total.laplacian_sum_squares += band.laplacian_sum_squares;
+    total.clipped += band.clipped;
+    total.pixels += band.pixels;
+}
+
+// Variance of the Laplacian, the usual focus score: higher is sharper.
+static inline double laplacian_variance(const image_stats& stats) {
+    if (!stats.pixels) {
+        return 0;
+    }
+    double mean = (double)stats.laplacian_sum / stats.pixels;
+    return (double)stats.laplacian_sum_squares / stats.pixels - mean * mean;
+}
+
+#endif
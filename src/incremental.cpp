@@ -0,0 +1,96 @@
+#include "incremental.h"
+
+#include <algorithm>
+#include <cstring>
+
+incremental_pipeline::incremental_pipeline(int tile_size, simd_level level)
+    : tile_size(std::max(1, tile_size)), level(level), rgb(false), width(0), height(0), tiles_x(0), tiles_y(0),
+      last_dirty(0), tiles_seen(0), dirty_seen(0) {}
+
+void incremental_pipeline::resize(bool rgb, int width, int height) {
+    size_t pixels = (size_t)width * height;
+    this->rgb = rgb;
+    this->width = width;
+    this->height = height;
+    tiles_x = (width + tile_size - 1) / tile_size;
+    tiles_y = (height + tile_size - 1) / tile_size;
+    previous.resize(pixels * (rgb ? 3 : 1));
+    dirty.assign((size_t)tiles_x * tiles_y, 0);
+    gray.resize(pixels);
+    filtered_frame.resize(pixels);
+    sharpened_frame.resize(pixels);
+}
+
+void incremental_pipeline::run(const uint8_t* input, bool rgb, int width, int height) {
+    int bytes_per_pixel = rgb ? 3 : 1;
+    size_t row_bytes = (size_t)width * bytes_per_pixel;
+
+    if (rgb != this->rgb || width != this->width || height != this->height) {
+        resize(rgb, width, height);
+        memcpy(previous.data(), input, previous.size());
+        if (rgb) {
+            grayscale_simd(input, gray.data(), width, height, level);
+        } else {
+            memcpy(gray.data(), input, gray.size());
+        }
+        laplacian_simd(gray.data(), filtered_frame.data(), width, height, level);
+        sharpen_simd(gray.data(), filtered_frame.data(), sharpened_frame.data(), width, height, level);
+        last_dirty = tiles();
+        tiles_seen += tiles();
+        dirty_seen += tiles();
+        return;
+    }
+
+    // Compare and refresh the grayscale frame tile by tile. memcmp is
+    // vectorised in libc and stops at the first difference.
+    last_dirty = 0;
+    for (int ty = 0; ty < tiles_y; ty++) {
+        int y0 = ty * tile_size, y1 = std::min(height, y0 + tile_size);
+        for (int tx = 0; tx < tiles_x; tx++) {
+            int x0 = tx * tile_size, x1 = std::min(width, x0 + tile_size);
+            size_t offset = (size_t)x0 * bytes_per_pixel, span = (size_t)(x1 - x0) * bytes_per_pixel;
+            bool changed = false;
+            for (int y = y0; y < y1 && !changed; y++) {
+                changed = memcmp(input + y * row_bytes + offset, &previous[y * row_bytes + offset], span) != 0;
+            }
+            dirty[ty * tiles_x + tx] = changed;
+            if (!changed) {
+                continue;
+            }
+            last_dirty++;
+            for (int y = y0; y < y1; y++) {
+                memcpy(&previous[y * row_bytes + offset], input + y * row_bytes + offset, span);
+                if (rgb) {
+                    grayscale_simd(input + y * row_bytes + offset, &gray[(size_t)y * width + x0], x1 - x0, 1, level);
+                } else {
+                    memcpy(&gray[(size_t)y * width + x0], input + y * row_bytes + offset, span);
+                }
+            }
+        }
+    }
+    tiles_seen += tiles();
+    dirty_seen += last_dirty;
+
+    // The grayscale frame is now complete, so the halo of every dirty tile
+    // reads current pixels even where it reaches into a neighbouring tile.
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            if (dirty[ty * tiles_x + tx]) {
+                int x0 = tx * tile_size, y0 = ty * tile_size;
+                recompute(std::max(0, x0 - 1), std::max(0, y0 - 1), std::min(width, x0 + tile_size + 1),
+                          std::min(height, y0 + tile_size + 1));
+            }
+        }
+    }
+}
+
+// Laplacian and sharpen over columns x0 .. x1-1 of rows y0 .. y1-1.
+void incremental_pipeline::recompute(int x0, int y0, int x1, int y1) {
+    for (int y = y0; y < y1; y++) {
+        const uint8_t* row = &gray[(size_t)y * width];
+        laplacian_span_simd(y > 0 ? row - width : 0, row, y < height - 1 ? row + width : 0,
+                            &filtered_frame[(size_t)y * width], y, x0, x1, width, height, level);
+        size_t offset = (size_t)y * width + x0;
+        sharpen_simd(&gray[offset], &filtered_frame[offset], &sharpened_frame[offset], x1 - x0, 1, level);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdint.h>
+#include <vector>
+#include "simd.h"
+
+// Pipeline for frame sequences that change little from one frame to the
+// next, such as a fixed camera. Each frame is compared with the previous one
+// tile by tile. Grayscale is redone only on tiles that changed, and the
+// Laplacian and sharpen only on those tiles plus the one-pixel ring their
+// stencil reaches. Everything else keeps the previous frame's output. The
+// outputs are identical to running the kernels over the whole frame.
+class incremental_pipeline {
+public:
+    // tile_size x tile_size pixel tiles.
+    explicit incremental_pipeline(int tile_size = 32, simd_level level = simd_best());
+
+    // Processes the next frame: packed RGB when rgb is set, otherwise a luma
+    // plane that is used as the grayscale frame directly. A frame of a new
+    // size is computed in full.
+    void run(const uint8_t* input, bool rgb, int width, int height);
+
+    // Forgets the previous frame, so the next one is computed in full.
+    void reset() { width = height = 0; }
+
+    const uint8_t* grayscale() const { return gray.data(); }
+    const uint8_t* filtered() const { return filtered_frame.data(); }
+    const uint8_t* sharpened() const { return sharpened_frame.data(); }
+
+    // Tiles in the last frame and how many of them were recomputed.
+    int tiles() const { return tiles_x * tiles_y; }
+    int dirty_tiles() const { return last_dirty; }
+
+    // Over every frame since construction.
+    long total_tiles() const { return tiles_seen; }
+    long total_dirty_tiles() const { return dirty_seen; }
+    double recomputed_fraction() const { return tiles_seen ? (double)dirty_seen / tiles_seen : 0; }
+
+private:
+    void resize(bool rgb, int width, int height);
+    void recompute(int x0, int y0, int x1, int y1);
+
+    int tile_size;
+    simd_level level;
+    bool rgb;
+    int width, height;
+    int tiles_x, tiles_y;
+    int last_dirty;
+    long tiles_seen, dirty_seen;
+
+    std::vector<uint8_t> previous;  // last input frame
+    std::vector<uint8_t> dirty;     // per tile
+    std::vector<uint8_t> gray, filtered_frame, sharpened_frame;
+};
+
+#endif
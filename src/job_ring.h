@@ -0,0 +1,92 @@
+#ifndef JOB_RING_H
+#define JOB_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct job_ring_header;
+struct job_slot;
+
+// Jobs passed between local processes through a POSIX shared-memory segment.
+//
+// The server creates the segment with a fixed number of slots, each with
+// room for one RGB input of up to max_pixels pixels and its grayscale,
+// filtered and sharpened outputs. A client claims a free slot, writes the
+// image straight into input(), submits it and waits; the server processes
+// jobs in submission order, reading the input and writing the outputs in
+// place, so no pixels are copied between the processes.
+//
+// Client:
+//     job_ring ring;
+//     ring.open("/laplacian");
+//     int slot = ring.claim();
+//     fill ring.input(slot) with width * height * 3 bytes
+//     ring.submit(slot, width, height);
+//     if (ring.wait(slot))
+//         use ring.sharpened(slot) ...
+//     ring.release(slot);
+//
+// Server:
+//     ring.create("/laplacian", slots, max_pixels);
+//     for (int slot; (slot = ring.next_job()) >= 0;)
+//         ring.complete(slot, process(ring.input(slot), ring.output(slot, ...), ...));
+class job_ring {
+public:
+    enum output_plane { GRAYSCALE, FILTERED, SHARPENED, OUTPUT_COUNT };
+
+    job_ring() : header(NULL), mapping(NULL), mapping_size(0), owner(false) {}
+    ~job_ring() { close(); }
+
+    // Server side: creates the segment, replacing a stale one of the same
+    // name. name follows shm_open(), e.g. "/laplacian".
+    bool create(const char* name, int slots, size_t max_pixels);
+    // Client side: attaches to a segment made by create().
+    bool open(const char* name);
+    // Unmaps the segment; the creator also removes its name.
+    void close();
+
+    int slots() const;
+    size_t max_pixels() const;
+
+    // Client: blocks until a slot is free and returns it (-1 after shutdown).
+    int claim();
+    // Input buffer of a claimed slot, max_pixels * 3 bytes.
+    unsigned char* input(int slot);
+    // Queues the claimed slot's input for the server; false if it is larger
+    // than max_pixels.
+    bool submit(int slot, int width, int height);
+    // Waits for the submitted job; true if the server processed it.
+    // timeout_ms < 0 waits for ever. On a timeout the job is withdrawn and
+    // the slot freed (release() is then a no-op), unless the server has
+    // already started it; then this keeps waiting until it completes.
+    bool wait(int slot, int timeout_ms = -1);
+    const unsigned char* grayscale(int slot) const { return result(slot, GRAYSCALE); }
+    const unsigned char* filtered(int slot) const { return result(slot, FILTERED); }
+    const unsigned char* sharpened(int slot) const { return result(slot, SHARPENED); }
+    // Hands a slot back once its outputs have been used. Does nothing for a
+    // slot that is already free or that the server is still running.
+    void release(int slot);
+
+    // Server: blocks for the oldest submitted job and returns its slot, or -1
+    // once shutdown() was called.
+    int next_job();
+    int width(int slot) const;
+    int height(int slot) const;
+    unsigned char* output(int slot, output_plane which);
+    // Marks the job finished and wakes its client.
+    void complete(int slot, bool ok);
+    // Makes next_job() and claim() return -1. Safe to call from a signal handler.
+    void shutdown();
+
+private:
+    job_slot* slot_at(int slot) const;
+    const unsigned char* result(int slot, output_plane which) const;
+
+    job_ring_header* header;
+    void* mapping;
+    size_t mapping_size;
+    bool owner;
+    char name[256];
+};
+
+#endif
@@ -0,0 +1,457 @@
+#include "simd.h"
+#include "hls.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#define SIMD_FUNCTION(isa) __attribute__((target(isa)))
+
+simd_level simd_best() {
+#ifdef SIMD_X86
+    static const simd_level best = __builtin_cpu_supports("avx2")   ? SIMD_AVX2
+                                   : __builtin_cpu_supports("sse4.1") ? SIMD_SSE41
+                                                                      : SIMD_SCALAR;
+    return best;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+const char* simd_level_name(simd_level level) {
+    switch (level) {
+    case SIMD_AVX2:
+        return "avx2";
+    case SIMD_SSE41:
+        return "sse4.1";
+    default:
+        return "scalar";
+    }
+}
+
+// Input pixel as laplacian() sees it, including the zeroed row height-2 and
+// column width-2 it keeps for compatibility (see laplacian_shift in hls.cpp).
+static int stencil_input(const uint8_t* row, int x, int y, int width, int height) {
+    if ((y == height - 2 && x <= width - 2) || (x == width - 2 && y <= height - 2)) {
+        return 0;
+    }
+    return row[x];
+}
+
+static uint8_t laplacian_pixel(const uint8_t* above, const uint8_t* row, const uint8_t* below,
+                               int x, int y, int width, int height) {
+    int filtered_value = 4 * stencil_input(row, x, y, width, height)
+                         - stencil_input(above, x, y - 1, width, height)
+                         - stencil_input(below, x, y + 1, width, height)
+                         - stencil_input(row, x - 1, y, width, height)
+                         - stencil_input(row, x + 1, y, width, height);
+    return filtered_value < 0 ? 0 : (filtered_value > 255 ? 255 : filtered_value);
+}
+
+#ifdef SIMD_X86
+
+// Splits 16 packed 3-byte pixels into one vector per channel.
+SIMD_FUNCTION("sse4.1")
+static inline void deinterleave_rgb(const uint8_t* input, __m128i& r, __m128i& g, __m128i& b) {
+    __m128i a = _mm_loadu_si128((const __m128i*)input);
+    __m128i m = _mm_loadu_si128((const __m128i*)(input + 16));
+    __m128i z = _mm_loadu_si128((const __m128i*)(input + 32));
+    r = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(m, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(z, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    g = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(m, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(z, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    b = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(m, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(z, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+// Weighted sum of four pixels held as 32-bit lanes. The float form uses the
+// same multiply/add order as the scalar expression and no FMA, so each lane
+// rounds exactly as the scalar code does.
+SIMD_FUNCTION("sse4.1")
+static inline __m128i gray4_sse41(__m128i r, __m128i g, __m128i b) {
+#if GRAYSCALE_MODE == GRAYSCALE_FIXED
+    __m128i sum = _mm_add_epi32(_mm_mullo_epi32(r, _mm_set1_epi32(GRAYSCALE_FIXED_COEF(0.299))),
+                                _mm_mullo_epi32(g, _mm_set1_epi32(GRAYSCALE_FIXED_COEF(0.587))));
+    sum = _mm_add_epi32(sum, _mm_mullo_epi32(b, _mm_set1_epi32(GRAYSCALE_FIXED_COEF(0.114))));
+    sum = _mm_add_epi32(sum, _mm_set1_epi32(1 << (GRAYSCALE_FRAC_BITS - 1)));
+    return _mm_min_epi32(_mm_srli_epi32(sum, GRAYSCALE_FRAC_BITS), _mm_set1_epi32(255));
+#else
+    __m128 sum = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.299f), _mm_cvtepi32_ps(r)),
+                            _mm_mul_ps(_mm_set1_ps(0.587f), _mm_cvtepi32_ps(g)));
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(0.114f), _mm_cvtepi32_ps(b)));
+    return _mm_cvttps_epi32(sum);
+#endif
+}
+
+SIMD_FUNCTION("avx2")
+static inline __m256i gray8_avx2(__m256i r, __m256i g, __m256i b) {
+#if GRAYSCALE_MODE == GRAYSCALE_FIXED
+    __m256i sum = _mm256_add_epi32(_mm256_mullo_epi32(r, _mm256_set1_epi32(GRAYSCALE_FIXED_COEF(0.299))),
+                                   _mm256_mullo_epi32(g, _mm256_set1_epi32(GRAYSCALE_FIXED_COEF(0.587))));
+    sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(b, _mm256_set1_epi32(GRAYSCALE_FIXED_COEF(0.114))));
+    sum = _mm256_add_epi32(sum, _mm256_set1_epi32(1 << (GRAYSCALE_FRAC_BITS - 1)));
+    return _mm256_min_epi32(_mm256_srli_epi32(sum, GRAYSCALE_FRAC_BITS), _mm256_set1_epi32(255));
+#else
+    __m256 sum = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(0.299f), _mm256_cvtepi32_ps(r)),
+                               _mm256_mul_ps(_mm256_set1_ps(0.587f), _mm256_cvtepi32_ps(g)));
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(0.114f), _mm256_cvtepi32_ps(b)));
+    return _mm256_cvttps_epi32(sum);
+#endif
+}
+
+SIMD_FUNCTION("sse4.1")
+static int grayscale_sse41(const uint8_t* input_image, uint8_t* output_image, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i r, g, b;
+        deinterleave_rgb(input_image + i * 3, r, g, b);
+        __m128i q0 = gray4_sse41(_mm_cvtepu8_epi32(r), _mm_cvtepu8_epi32(g), _mm_cvtepu8_epi32(b));
+        __m128i q1 = gray4_sse41(_mm_cvtepu8_epi32(_mm_srli_si128(r, 4)), _mm_cvtepu8_epi32(_mm_srli_si128(g, 4)),
+                                 _mm_cvtepu8_epi32(_mm_srli_si128(b, 4)));
+        __m128i q2 = gray4_sse41(_mm_cvtepu8_epi32(_mm_srli_si128(r, 8)), _mm_cvtepu8_epi32(_mm_srli_si128(g, 8)),
+                                 _mm_cvtepu8_epi32(_mm_srli_si128(b, 8)));
+        __m128i q3 = gray4_sse41(_mm_cvtepu8_epi32(_mm_srli_si128(r, 12)), _mm_cvtepu8_epi32(_mm_srli_si128(g, 12)),
+                                 _mm_cvtepu8_epi32(_mm_srli_si128(b, 12)));
+        __m128i gray = _mm_packus_epi16(_mm_packus_epi32(q0, q1), _mm_packus_epi32(q2, q3));
+        _mm_storeu_si128((__m128i*)(output_image + i), gray);
+    }
+    return i;
+}
+
+SIMD_FUNCTION("avx2")
+static int grayscale_avx2(const uint8_t* input_image, uint8_t* output_image, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i r, g, b;
+        deinterleave_rgb(input_image + i * 3, r, g, b);
+        __m256i lo = gray8_avx2(_mm256_cvtepu8_epi32(r), _mm256_cvtepu8_epi32(g), _mm256_cvtepu8_epi32(b));
+        __m256i hi = gray8_avx2(_mm256_cvtepu8_epi32(_mm_srli_si128(r, 8)), _mm256_cvtepu8_epi32(_mm_srli_si128(g, 8)),
+                                _mm256_cvtepu8_epi32(_mm_srli_si128(b, 8)));
+        // packus works per 128-bit lane; the permute restores pixel order.
+        __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+        __m128i gray = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+        _mm_storeu_si128((__m128i*)(output_image + i), gray);
+    }
+    return i;
+}
+
+// 4*centre - left - right - up - down on 16 pixels, saturated to 0..255.
+SIMD_FUNCTION("sse4.1")
+static inline __m128i stencil_sse41(__m128i c, __m128i l, __m128i r, __m128i u, __m128i d) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_slli_epi16(_mm_unpacklo_epi8(c, zero), 2);
+    __m128i hi = _mm_slli_epi16(_mm_unpackhi_epi8(c, zero), 2);
+    lo = _mm_sub_epi16(lo, _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(l, zero), _mm_unpacklo_epi8(r, zero)),
+                                         _mm_add_epi16(_mm_unpacklo_epi8(u, zero), _mm_unpacklo_epi8(d, zero))));
+    hi = _mm_sub_epi16(hi, _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(l, zero), _mm_unpackhi_epi8(r, zero)),
+                                         _mm_add_epi16(_mm_unpackhi_epi8(u, zero), _mm_unpackhi_epi8(d, zero))));
+    return _mm_packus_epi16(lo, hi);
+}
+
+SIMD_FUNCTION("avx2")
+static inline __m256i stencil_avx2(__m256i c, __m256i l, __m256i r, __m256i u, __m256i d) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_slli_epi16(_mm256_unpacklo_epi8(c, zero), 2);
+    __m256i hi = _mm256_slli_epi16(_mm256_unpackhi_epi8(c, zero), 2);
+    lo = _mm256_sub_epi16(lo, _mm256_add_epi16(
+                                  _mm256_add_epi16(_mm256_unpacklo_epi8(l, zero), _mm256_unpacklo_epi8(r, zero)),
+                                  _mm256_add_epi16(_mm256_unpacklo_epi8(u, zero), _mm256_unpacklo_epi8(d, zero))));
+    hi = _mm256_sub_epi16(hi, _mm256_add_epi16(
+                                  _mm256_add_epi16(_mm256_unpackhi_epi8(l, zero), _mm256_unpackhi_epi8(r, zero)),
+                                  _mm256_add_epi16(_mm256_unpackhi_epi8(u, zero), _mm256_unpackhi_epi8(d, zero))));
+    // unpack and packus both work within 128-bit lanes, so pixel order is kept.
+    return _mm256_packus_epi16(lo, hi);
+}
+
+// Vector part of one Laplacian row: every x from 1 whose stencil stays clear
+// of column width-2. Returns the first x left for the scalar code.
+SIMD_FUNCTION("sse4.1")
+static int laplacian_row_sse41(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* output_row,
+                               int x, int end) {
+    for (; x + 16 <= end; x += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i l = _mm_loadu_si128((const __m128i*)(row + x - 1));
+        __m128i r = _mm_loadu_si128((const __m128i*)(row + x + 1));
+        __m128i u = _mm_loadu_si128((const __m128i*)(above + x));
+        __m128i d = _mm_loadu_si128((const __m128i*)(below + x));
+        _mm_storeu_si128((__m128i*)(output_row + x), stencil_sse41(c, l, r, u, d));
+    }
+    return x;
+}
+
+SIMD_FUNCTION("avx2")
+static int laplacian_row_avx2(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* output_row,
+                              int x, int end) {
+    for (; x + 32 <= end; x += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(row + x));
+        __m256i l = _mm256_loadu_si256((const __m256i*)(row + x - 1));
+        __m256i r = _mm256_loadu_si256((const __m256i*)(row + x + 1));
+        __m256i u = _mm256_loadu_si256((const __m256i*)(above + x));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(below + x));
+        _mm256_storeu_si256((__m256i*)(output_row + x), stencil_avx2(c, l, r, u, d));
+    }
+    for (; x + 16 <= end; x += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i l = _mm_loadu_si128((const __m128i*)(row + x - 1));
+        __m128i r = _mm_loadu_si128((const __m128i*)(row + x + 1));
+        __m128i u = _mm_loadu_si128((const __m128i*)(above + x));
+        __m128i d = _mm_loadu_si128((const __m128i*)(below + x));
+        _mm_storeu_si128((__m128i*)(output_row + x), stencil_sse41(c, l, r, u, d));
+    }
+    return x;
+}
+
+SIMD_FUNCTION("sse4.1")
+static int sharpen_sse41(const uint8_t* original_image, const uint8_t* filtered_output, uint8_t* sharpened_output,
+                         int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i o = _mm_loadu_si128((const __m128i*)(original_image + i));
+        __m128i f = _mm_loadu_si128((const __m128i*)(filtered_output + i));
+        _mm_storeu_si128((__m128i*)(sharpened_output + i), _mm_adds_epu8(o, f));
+    }
+    return i;
+}
+
+SIMD_FUNCTION("avx2")
+static int sharpen_avx2(const uint8_t* original_image, const uint8_t* filtered_output, uint8_t* sharpened_output,
+                        int count) {
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i o = _mm256_loadu_si256((const __m256i*)(original_image + i));
+        __m256i f = _mm256_loadu_si256((const __m256i*)(filtered_output + i));
+        _mm256_storeu_si256((__m256i*)(sharpened_output + i), _mm256_adds_epu8(o, f));
+    }
+    return i;
+}
+
+// Adds the sum and sum of squares of count filtered pixels to stats, and how
+// many of them sharpen clips against the grayscale pixels. Squares gather in
+// 32-bit lanes, each of which gains at most four squares of 255 per
+// iteration, so they are flushed into the 64-bit total every
+// STATS_FLUSH_ITERATIONS iterations, before they can wrap.
+#define STATS_FLUSH_ITERATIONS 16384
+
+SIMD_FUNCTION("sse4.1")
+static uint64_t lane_total_sse41(__m128i squares) {
+    uint32_t partial[4];
+    _mm_storeu_si128((__m128i*)partial, squares);
+    return (uint64_t)partial[0] + partial[1] + partial[2] + partial[3];
+}
+
+SIMD_FUNCTION("sse4.1")
+static int row_stats_sse41(const uint8_t* gray, const uint8_t* filtered, int count, image_stats& stats) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero, squares = zero;
+    int clipped = 0;
+    int pending = 0;
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i g = _mm_loadu_si128((const __m128i*)(gray + i));
+        __m128i f = _mm_loadu_si128((const __m128i*)(filtered + i));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(f, zero));
+        __m128i lo = _mm_unpacklo_epi8(f, zero), hi = _mm_unpackhi_epi8(f, zero);
+        squares = _mm_add_epi32(squares, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        if (++pending == STATS_FLUSH_ITERATIONS) {
+            stats.laplacian_sum_squares += lane_total_sse41(squares);
+            squares = zero;
+            pending = 0;
+        }
+        // The saturating and the wrapping add only differ where sharpen clips.
+        __m128i same = _mm_cmpeq_epi8(_mm_adds_epu8(g, f), _mm_add_epi8(g, f));
+        clipped += 16 - __builtin_popcount(_mm_movemask_epi8(same));
+    }
+    uint64_t sums[2];
+    _mm_storeu_si128((__m128i*)sums, sum);
+    stats.laplacian_sum += sums[0] + sums[1];
+    stats.laplacian_sum_squares += lane_total_sse41(squares);
+    stats.clipped += clipped;
+    return i;
+}
+
+SIMD_FUNCTION("avx2")
+static uint64_t lane_total_avx2(__m256i squares) {
+    uint32_t partial[8];
+    _mm256_storeu_si256((__m256i*)partial, squares);
+    uint64_t total = 0;
+    for (int k = 0; k < 8; k++) {
+        total += partial[k];
+    }
+    return total;
+}
+
+SIMD_FUNCTION("avx2")
+static int row_stats_avx2(const uint8_t* gray, const uint8_t* filtered, int count, image_stats& stats) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i sum = zero, squares = zero;
+    int clipped = 0;
+    int pending = 0;
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i g = _mm256_loadu_si256((const __m256i*)(gray + i));
+        __m256i f = _mm256_loadu_si256((const __m256i*)(filtered + i));
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(f, zero));
+        __m256i lo = _mm256_unpacklo_epi8(f, zero), hi = _mm256_unpackhi_epi8(f, zero);
+        squares = _mm256_add_epi32(squares, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+        if (++pending == STATS_FLUSH_ITERATIONS) {
+            stats.laplacian_sum_squares += lane_total_avx2(squares);
+            squares = zero;
+            pending = 0;
+        }
+        __m256i same = _mm256_cmpeq_epi8(_mm256_adds_epu8(g, f), _mm256_add_epi8(g, f));
+        clipped += 32 - __builtin_popcount((unsigned)_mm256_movemask_epi8(same));
+    }
+    uint64_t sums[4];
+    _mm256_storeu_si256((__m256i*)sums, sum);
+    stats.laplacian_sum += sums[0] + sums[1] + sums[2] + sums[3];
+    stats.laplacian_sum_squares += lane_total_avx2(squares);
+    stats.clipped += clipped;
+    return i;
+}
+
+#endif
+
+void grayscale_simd(const uint8_t* input_image, uint8_t* output_image, int width, int height, simd_level level) {
+    int count = width * height;
+    int done = 0;
+#ifdef SIMD_X86
+    if (level == SIMD_AVX2) {
+        done = grayscale_avx2(input_image, output_image, count);
+    } else if (level == SIMD_SSE41) {
+        done = grayscale_sse41(input_image, output_image, count);
+    }
+#endif
+    if (done < count) {
+        grayscale(input_image + done * 3, output_image + done, count - done, 1);
+    }
+}
+
+void laplacian_row_simd(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* output_row,
+                        int y, int width, int height, simd_level level) {
+    laplacian_span_simd(above, row, below, output_row, y, 0, width, width, height, level);
+}
+
+void laplacian_span_simd(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* output_row,
+                         int y, int x0, int x1, int width, int height, simd_level level) {
+    if (y == 0 || y == height - 1) {
+        for (int x = x0; x < x1; x++) {
+            output_row[x] = 0;
+        }
+        return;
+    }
+
+    // Rows from height-3 on read the zeroed row height-2 and go through the
+    // scalar code entirely; vectors stop short of the zeroed column width-2.
+    int x = x0 > 1 ? x0 : 1;
+#ifdef SIMD_X86
+    if (y < height - 3) {
+        int end = x1 < width - 3 ? x1 : width - 3;
+        if (level == SIMD_AVX2) {
+            x = laplacian_row_avx2(above, row, below, output_row, x, end);
+        } else if (level == SIMD_SSE41) {
+            x = laplacian_row_sse41(above, row, below, output_row, x, end);
+        }
+    }
+#endif
+    if (x0 == 0) {
+        output_row[0] = 0;
+    }
+    for (; x < x1 && x < width - 1; x++) {
+        output_row[x] = laplacian_pixel(above, row, below, x, y, width, height);
+    }
+    if (x1 == width) {
+        output_row[width - 1] = 0;
+    }
+}
+
+void laplacian_simd(const uint8_t* grayscale_output, uint8_t* filtered_output, int width, int height,
+                    simd_level level) {
+    // Every level goes through the row kernel, which has scalar code of its
+    // own, so no level depends on a line buffer of fixed width.
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = grayscale_output + y * width;
+        laplacian_row_simd(y > 0 ? row - width : 0, row, y < height - 1 ? row + width : 0,
+                           filtered_output + y * width, y, width, height, level);
+    }
+}
+
+void sharpen_simd(const uint8_t* original_image, const uint8_t* filtered_output, uint8_t* sharpened_output,
+                  int width, int height, simd_level level) {
+    int count = width * height;
+    int done = 0;
+#ifdef SIMD_X86
+    if (level == SIMD_AVX2) {
+        done = sharpen_avx2(original_image, filtered_output, sharpened_output, count);
+    } else if (level == SIMD_SSE41) {
+        done = sharpen_sse41(original_image, filtered_output, sharpened_output, count);
+    }
+#endif
+    if (done < count) {
+        sharpen(original_image + done, filtered_output + done, sharpened_output + done, count - done, 1);
+    }
+}
+
+// Row by row, so the grayscale row the Laplacian needs next and the rows the
+// statistics read are still in cache when they are used.
+void laplacian_sharpen_stats_simd(const uint8_t* input_image, uint8_t* grayscale_output, uint8_t* filtered_output,
+                                  uint8_t* sharpened_output, int width, int height, image_stats& stats,
+                                  simd_level level) {
+    image_stats_clear(stats);
+    // Four histograms, so runs of equal pixels do not wait on one counter.
+    static const int BANKS = 4;
+    uint32_t counts[BANKS][256] = {};
+
+    for (int y = 0; y <= height; y++) {
+        if (y < height) {
+            grayscale_simd(input_image + (size_t)y * width * 3, grayscale_output + (size_t)y * width, width, 1,
+                           level);
+        }
+        if (y == 0) {
+            continue;
+        }
+        int r = y - 1;
+        const uint8_t* gray = grayscale_output + (size_t)r * width;
+        uint8_t* filtered = filtered_output + (size_t)r * width;
+        laplacian_row_simd(r > 0 ? gray - width : 0, gray, r < height - 1 ? gray + width : 0, filtered, r, width,
+                           height, level);
+        sharpen_simd(gray, filtered, sharpened_output + (size_t)r * width, width, 1, level);
+
+        int x = 0;
+        for (; x + BANKS <= width; x += BANKS) {
+            for (int k = 0; k < BANKS; k++) {
+                counts[k][gray[x + k]]++;
+            }
+        }
+        for (; x < width; x++) {
+            counts[0][gray[x]]++;
+        }
+
+        int done = 0;
+#ifdef SIMD_X86
+        if (level == SIMD_AVX2) {
+            done = row_stats_avx2(gray, filtered, width, stats);
+        } else if (level == SIMD_SSE41) {
+            done = row_stats_sse41(gray, filtered, width, stats);
+        }
+#endif
+        for (x = done; x < width; x++) {
+            stats.laplacian_sum += filtered[x];
+            stats.laplacian_sum_squares += filtered[x] * filtered[x];
+            stats.clipped += gray[x] + filtered[x] > 255;
+        }
+    }
+
+    for (int i = 0; i < 256; i++) {
+        for (int k = 0; k < BANKS; k++) {
+            stats.histogram[i] += counts[k][i];
+        }
+    }
+    stats.pixels = (uint32_t)width * height;
+}
@@ -0,0 +1,39 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdint.h>
+#include "image_stats.h"
+
+// Vectorized host versions of the kernels in hls.cpp. Every level produces
+// the same bytes as the scalar templates; SIMD_SCALAR simply calls them.
+enum simd_level { SIMD_SCALAR, SIMD_SSE41, SIMD_AVX2 };
+
+// Best level the CPU supports, detected once through CPUID.
+simd_level simd_best();
+const char* simd_level_name(simd_level level);
+
+void grayscale_simd(const uint8_t* input_image, uint8_t* output_image, int width, int height,
+                    simd_level level = simd_best());
+void laplacian_simd(const uint8_t* grayscale_output, uint8_t* filtered_output, int width, int height,
+                    simd_level level = simd_best());
+void sharpen_simd(const uint8_t* original_image, const uint8_t* filtered_output, uint8_t* sharpened_output,
+                  int width, int height, simd_level level = simd_best());
+
+// Computes row y of the Laplacian of a width x height frame from input rows
+// y-1, y and y+1. above and below are not read for the first and last row
+// and may then be null. Lets banded and streaming callers reuse the kernel.
+void laplacian_row_simd(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* output_row,
+                        int y, int width, int height, simd_level level = simd_best());
+
+// Same, but only writes output_row[x0 .. x1-1].
+void laplacian_span_simd(const uint8_t* above, const uint8_t* row, const uint8_t* below, uint8_t* output_row,
+                         int y, int x0, int x1, int width, int height, simd_level level = simd_best());
+
+// grayscale -> Laplacian -> sharpen into the three frames, like the three
+// calls above, and stats for the frame (see laplacian_sharpen_stats() in
+// hls.h) gathered from each row while it is still in cache.
+void laplacian_sharpen_stats_simd(const uint8_t* input_image, uint8_t* grayscale_output, uint8_t* filtered_output,
+                                  uint8_t* sharpened_output, int width, int height, image_stats& stats,
+                                  simd_level level = simd_best());
+
+#endif
@@ -0,0 +1,110 @@
+// Streaming front end for process_video(): sharpens a Y4M, raw YUV420 or raw
+// RGB24 stream from a file or stdin into a file or stdout and reports the
+// sustained frame rate. Build with -DHOST_ONLY; see README.md.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "video.h"
+
+static void print_usage() {
+    printf("\nUsage:\n");
+    printf("\tlaplacian_stream [--format=y4m|yuv420|rgb24] [--size=WxH] [--level=scalar|sse4.1|avx2]\n");
+    printf("\t                 [--incremental[=<tile>]] <input> <output>\n\n");
+    printf("<input>, <output>\n");
+    printf("\tFiles, or - for stdin and stdout.\n\n");
+    printf("[--format=y4m|yuv420|rgb24]\n");
+    printf("\tInput format (default: y4m). Y4M and YUV420 come out in the same format with\n");
+    printf("\tthe sharpened Y plane; RGB24 comes out as raw 8-bit gray frames.\n\n");
+    printf("[--size=WxH]\n");
+    printf("\tFrame size of yuv420 and rgb24 input.\n\n");
+    printf("[--level=scalar|sse4.1|avx2]\n");
+    printf("\tKernel implementation (default: the best the CPU supports).\n\n");
+    printf("[--incremental[=<tile>]]\n");
+    printf("\tOnly recompute <tile> x <tile> tiles (default 32) that differ from the previous frame.\n\n");
+}
+
+int main(int argc, char** argv) {
+    video_options options;
+    const char* paths[2] = {NULL, NULL};
+    int path_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--format=") == 0) {
+            std::string format = arg.substr(9);
+            if (format == "y4m") {
+                options.format = VIDEO_Y4M;
+            } else if (format == "yuv420") {
+                options.format = VIDEO_YUV420;
+            } else if (format == "rgb24") {
+                options.format = VIDEO_RGB24;
+            } else {
+                fprintf(stderr, "Error: unknown format %s\n", format.c_str());
+                return 1;
+            }
+        } else if (arg.compare(0, 7, "--size=") == 0) {
+            if (sscanf(arg.c_str() + 7, "%dx%d", &options.width, &options.height) != 2) {
+                fprintf(stderr, "Error: bad size %s\n", arg.c_str() + 7);
+                return 1;
+            }
+        } else if (arg.compare(0, 8, "--level=") == 0) {
+            std::string level = arg.substr(8);
+            bool found = false;
+            for (int l = SIMD_SCALAR; l <= simd_best(); l++) {
+                if (level == simd_level_name(simd_level(l))) {
+                    options.level = simd_level(l);
+                    found = true;
+                }
+            }
+            if (!found) {
+                fprintf(stderr, "Error: %s is unknown or not supported by this CPU\n", level.c_str());
+                return 1;
+            }
+        } else if (arg == "--incremental") {
+            options.incremental_tile = 32;
+        } else if (arg.compare(0, 14, "--incremental=") == 0) {
+            options.incremental_tile = atoi(arg.c_str() + 14);
+            if (options.incremental_tile < 1) {
+                fprintf(stderr, "Error: bad tile size %s\n", arg.c_str() + 14);
+                return 1;
+            }
+        } else if (path_count < 2 && (arg == "-" || arg[0] != '-')) {
+            paths[path_count++] = argv[i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (path_count != 2) {
+        print_usage();
+        return 1;
+    }
+
+    FILE* input = strcmp(paths[0], "-") == 0 ? stdin : fopen(paths[0], "rb");
+    if (!input) {
+        fprintf(stderr, "Error: could not open %s\n", paths[0]);
+        return 1;
+    }
+    FILE* output = strcmp(paths[1], "-") == 0 ? stdout : fopen(paths[1], "wb");
+    if (!output) {
+        fprintf(stderr, "Error: could not create %s\n", paths[1]);
+        return 1;
+    }
+
+    video_stats stats;
+    bool ok = process_video(input, output, options, stats);
+    if (input != stdin)
+        fclose(input);
+    if (output != stdout && fclose(output) != 0)
+        ok = false;
+
+    // The report goes to stderr so that stdout can carry the stream.
+    fprintf(stderr, "%d frames of %dx%d (%s): %.1f fps sustained, %.1f fps in the kernels\n", stats.frames,
+            stats.width, stats.height, simd_level_name(options.level), stats.fps(), stats.compute_fps());
+    if (options.incremental_tile > 0) {
+        fprintf(stderr, "%ld of %ld tiles recomputed (%.1f%%)\n", stats.dirty_tiles, stats.tiles,
+                100 * stats.recomputed_fraction());
+    }
+    return ok ? 0 : 1;
+}
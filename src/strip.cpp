@@ -0,0 +1,62 @@
+#include "strip.h"
+
+#include <algorithm>
+#include <vector>
+#include "bmpfunction.h"
+
+bool process_bmp_strips(const char* input, const char* sharpened_output, const char* grayscale_output,
+                        const char* filtered_output, const strip_options& options) {
+    BMPStripReader reader;
+    if (!reader.open(input)) {
+        return false;
+    }
+    int width = reader.width;
+    int height = reader.height;
+    int strip_rows = std::max(1, options.strip_rows);
+
+    BMPGray8Writer sharpened_writer, grayscale_writer, filtered_writer;
+    if (!sharpened_writer.open(sharpened_output, width, height, reader.topDown) ||
+        (grayscale_output && !grayscale_writer.open(grayscale_output, width, height, reader.topDown)) ||
+        (filtered_output && !filtered_writer.open(filtered_output, width, height, reader.topDown))) {
+        return false;
+    }
+
+    std::vector<uint8_t> rgb(reader.rowStride * (strip_rows + 2));
+    std::vector<uint8_t> gray((size_t)width * (strip_rows + 2));
+    std::vector<uint8_t> filtered((size_t)width * strip_rows);
+    std::vector<uint8_t> sharpened((size_t)width * strip_rows);
+
+    // Rows are handled in file order; y is the row index the kernels see,
+    // which counts from the bottom of the picture.
+    for (int s0 = 0; s0 < height; s0 += strip_rows) {
+        int s1 = std::min(height, s0 + strip_rows);
+        int r0 = std::max(0, s0 - 1);
+        int r1 = std::min(height, s1 + 1);
+        if (!reader.readRows(r0, r1 - r0, rgb.data())) {
+            return false;
+        }
+        for (int i = r0; i < r1; i++) {
+            grayscale_simd(&rgb[reader.rowStride * (i - r0)], &gray[(size_t)width * (i - r0)], width, 1,
+                           options.level);
+        }
+
+        for (int i = s0; i < s1; i++) {
+            const uint8_t* row = &gray[(size_t)width * (i - r0)];
+            const uint8_t* previous = i > 0 ? row - width : 0;
+            const uint8_t* next = i < height - 1 ? row + width : 0;
+            int y = reader.topDown ? height - 1 - i : i;
+            laplacian_row_simd(reader.topDown ? next : previous, row, reader.topDown ? previous : next,
+                               &filtered[(size_t)width * (i - s0)], y, width, height, options.level);
+        }
+        const uint8_t* strip_gray = &gray[(size_t)width * (s0 - r0)];
+        sharpen_simd(strip_gray, filtered.data(), sharpened.data(), width, s1 - s0, options.level);
+
+        if (!sharpened_writer.writeRows(sharpened.data(), s1 - s0) ||
+            (grayscale_output && !grayscale_writer.writeRows(strip_gray, s1 - s0)) ||
+            (filtered_output && !filtered_writer.writeRows(filtered.data(), s1 - s0))) {
+            return false;
+        }
+    }
+    return sharpened_writer.close() && (!grayscale_output || grayscale_writer.close()) &&
+           (!filtered_output || filtered_writer.close());
+}
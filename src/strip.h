@@ -0,0 +1,22 @@
+#ifndef STRIP_H
+#define STRIP_H
+
+#include "simd.h"
+
+struct strip_options {
+    int strip_rows;    // rows read, processed and written per step
+    simd_level level;  // kernel implementation
+
+    strip_options() : strip_rows(64), level(simd_best()) {}
+};
+
+// Runs grayscale -> Laplacian -> sharpen over a 24-bit BMP of any height
+// without loading it: input rows are read strip_rows at a time (plus one halo
+// row either side), and each finished strip is appended to the outputs, which
+// are 8-bit BMPs in the input's row order. Peak memory is about
+// 6 * width * (strip_rows + 2) bytes. grayscale_output and filtered_output may
+// be null. Returns false if a file could not be read or written.
+bool process_bmp_strips(const char* input, const char* sharpened_output, const char* grayscale_output,
+                        const char* filtered_output, const strip_options& options = strip_options());
+
+#endif
@@ -1,41 +1,1111 @@
+#include <algorithm>
 #include <iostream>
+#include <fstream>
+#include <iterator>
 #include <vector>
 #include <cstring>
-#include "ap_int.h"
+#include "hls.h"
+#include "bmpfunction.h"
+#include "profile.h"
+#include "band_scheduler.h"
+#ifdef HOST_ONLY
+#include "simd.h"
+#include "tiled.h"
+#include "strip.h"
+#include "video.h"
+#include "incremental.h"
+#include "job_ring.h"
+#include "batch.h"
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-//#include "bmpfunction.cpp"
+// The same testbench runs as the HLS C simulation (ap_uint<8> pixels) and,
+// built with -DHOST_ONLY, as a plain host program on uint8_t.
+#ifdef HOST_ONLY
+typedef uint8_t pixel_t;
+#else
+typedef ap_uint<8> pixel_t;
+#endif
 
-// Include kernel function declarations
-void grayscale(ap_uint<8>* input_image, ap_uint<8>* output_image, const int width, const int height);
-void laplacian(ap_uint<8>* grayscale_output, ap_uint<8>* padded, ap_uint<8>* filtered_output, int width, int height);
-void sharpen(ap_uint<8>* original_image, ap_uint<8>* filtered_output, ap_uint<8>* sharpened_output, int width, int height);
+// Runs every RGB triple through grayscale() and counts results that differ
+// from the single-precision formula the kernel originally used.
+static long grayscale_sweep() {
+    const int width = 4096;
+    const int height = 4096;
+    std::vector<pixel_t> rgb(width * height * 3);
+    std::vector<pixel_t> gray(width * height);
+    for (int idx = 0; idx < width * height; idx++) {
+        rgb[idx * 3] = idx >> 16;
+        rgb[idx * 3 + 1] = (idx >> 8) & 0xFF;
+        rgb[idx * 3 + 2] = idx & 0xFF;
+    }
+    grayscale(rgb.data(), gray.data(), width, height);
 
-// BMP handling functions
-void readBMP(const char* filename, std::vector<ap_uint<8>>& data, int& width, int& height);
-void writeBMP(const char* filename, const std::vector<ap_uint<8>>& data, int width, int height);
-void writeBMPGray(const char* filename, const std::vector<ap_uint<8>>& data, int width, int height);
+    long mismatches = 0;
+    for (int idx = 0; idx < width * height; idx++) {
+        int r = idx >> 16, g = (idx >> 8) & 0xFF, b = idx & 0xFF;
+        unsigned int expected = static_cast<unsigned char>(0.299f * r + 0.587f * g + 0.114f * b);
+        if (gray[idx] != expected) {
+            if (mismatches < 10) {
+                std::cerr << "grayscale(" << r << ", " << g << ", " << b << ") = " << (unsigned int)gray[idx]
+                          << ", float reference " << expected << std::endl;
+            }
+            mismatches++;
+        }
+    }
+    std::cout << "Grayscale sweep: " << mismatches << " of " << width * height
+              << " RGB triples differ from the float reference" << std::endl;
+    return mismatches;
+}
+
+// Pseudo-random RGB frame for sizes the sample image does not cover.
+static std::vector<pixel_t> noise_frame(int width, int height) {
+    std::vector<pixel_t> rgb(width * height * 3);
+    uint32_t state = 12345;
+    for (size_t i = 0; i < rgb.size(); i++) {
+        state = state * 1103515245 + 12345;
+        rgb[i] = state >> 24;
+    }
+    return rgb;
+}
+
+#ifdef HOST_ONLY
+struct reference_frames {
+    std::vector<uint8_t> gray, filtered, sharpened;
+
+    reference_frames(int width, int height) : gray(width * height), filtered(width * height), sharpened(width * height) {}
+    bool operator!=(const reference_frames& other) const {
+        return gray != other.gray || filtered != other.filtered || sharpened != other.sharpened;
+    }
+};
+
+// Every SIMD level the CPU supports must reproduce the scalar kernels.
+static bool simd_matches(const std::vector<uint8_t>& rgb, int width, int height) {
+    reference_frames expected(width, height);
+    grayscale(rgb.data(), expected.gray.data(), width, height);
+    laplacian(expected.gray.data(), expected.filtered.data(), width, height);
+    sharpen(expected.gray.data(), expected.filtered.data(), expected.sharpened.data(), width, height);
+
+    for (int level = SIMD_SCALAR; level <= simd_best(); level++) {
+        reference_frames actual(width, height);
+        grayscale_simd(rgb.data(), actual.gray.data(), width, height, simd_level(level));
+        laplacian_simd(actual.gray.data(), actual.filtered.data(), width, height, simd_level(level));
+        sharpen_simd(actual.gray.data(), actual.filtered.data(), actual.sharpened.data(), width, height,
+                     simd_level(level));
+        if (actual != expected) {
+            std::cerr << simd_level_name(simd_level(level)) << " kernels differ from the scalar kernels on a "
+                      << width << "x" << height << " frame" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// The tiled engine must match the whole-frame kernels for any band split.
+static bool tiled_matches(const std::vector<uint8_t>& rgb, int width, int height) {
+    reference_frames expected(width, height);
+    grayscale(rgb.data(), expected.gray.data(), width, height);
+    laplacian(expected.gray.data(), expected.filtered.data(), width, height);
+    sharpen(expected.gray.data(), expected.filtered.data(), expected.sharpened.data(), width, height);
+
+    const int configs[][2] = {{1, 0}, {4, 1}, {3, 7}, {8, 64}};
+    for (int i = 0; i < 4; i++) {
+        tiled_options options;
+        options.threads = configs[i][0];
+        options.tile_rows = configs[i][1];
+        tiled_engine engine(options);
+
+        reference_frames actual(width, height);
+        engine.run(rgb.data(), actual.sharpened.data(), actual.gray.data(), actual.filtered.data(), width, height);
+        std::vector<uint8_t> sharpened_only(width * height);
+        engine.run(rgb.data(), sharpened_only.data(), 0, 0, width, height);
+        if (actual != expected || sharpened_only != expected.sharpened) {
+            std::cerr << "tiled engine (" << options.threads << " threads, " << options.tile_rows
+                      << " rows per band) differs on a " << width << "x" << height << " frame" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs the tiled engine straight off a mapped BMP and checks it against the
+// sharpened frame from the vector path.
+static bool mapped_matches(const char* filename, const std::vector<uint8_t>& expected) {
+    BMPView view;
+    if (!mapBMP(filename, view)) {
+        return false;
+    }
+    std::vector<uint8_t> sharpened(view.width * view.height);
+    tiled_engine engine;
+    engine.run(view.pixels, view.stride, sharpened.data(), 0, 0, view.width, view.height);
+    unmapBMP(view);
+    if (sharpened != expected) {
+        std::cerr << "tiled engine on the mapped " << filename << " differs" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Writes a top-down (negative height) copy of a bottom-up BMP.
+static void write_top_down(const char* input, const char* output) {
+    std::ifstream in(input, std::ios_base::binary);
+    std::vector<char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    int32_t offset, width, height;
+    memcpy(&offset, &file[10], 4);
+    memcpy(&width, &file[18], 4);
+    memcpy(&height, &file[22], 4);
+    size_t stride = (width * 3 + 3) & ~3;
+
+    std::vector<char> flipped(file);
+    for (int y = 0; y < height; y++) {
+        memcpy(&flipped[offset + y * stride], &file[offset + (height - 1 - y) * stride], stride);
+    }
+    height = -height;
+    memcpy(&flipped[22], &height, 4);
+    std::ofstream(output, std::ios_base::binary).write(flipped.data(), flipped.size());
+}
+
+// mapBMP must refuse headers whose sizes are empty, negate to nothing or
+// overflow the bound on the pixel data, and still take a valid 2x2 file.
+static bool bad_headers_rejected() {
+    char path[] = "/tmp/laplacian_header_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        std::cerr << "could not create a BMP file" << std::endl;
+        return false;
+    }
+    close(fd);
+
+    const int32_t cases[][3] = {// width, height, offset
+                                {2, 2, 54},       {2, 0, 54},          {2, INT_MIN, 54},
+                                {2, 3, 54},       {2, 2, 1 << 30},     {0x40000000, 2, 54},
+                                {INT_MAX, 2, 54}, {2, INT_MAX, 54},    {1, -INT_MAX, 54}};
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        std::vector<char> file(54 + 2 * 8);
+        int16_t planes = 1, bits = 24;
+        int32_t file_size = (int32_t)file.size(), info_size = 40;
+        memcpy(&file[0], "BM", 2);
+        memcpy(&file[2], &file_size, 4);
+        memcpy(&file[10], &cases[i][2], 4);
+        memcpy(&file[14], &info_size, 4);
+        memcpy(&file[18], &cases[i][0], 4);
+        memcpy(&file[22], &cases[i][1], 4);
+        memcpy(&file[26], &planes, 2);
+        memcpy(&file[28], &bits, 2);
+        std::ofstream(path, std::ios_base::binary).write(file.data(), file.size());
+
+        BMPView view;
+        bool mapped = mapBMP(path, view);
+        unmapBMP(view);
+        if (mapped != (i == 0)) {
+            std::cerr << "mapBMP " << (mapped ? "took" : "refused") << " a " << cases[i][0] << "x" << cases[i][1]
+                      << " header with its pixels at " << cases[i][2] << std::endl;
+            ok = false;
+        }
+    }
+    remove(path);
+    return ok;
+}
+
+// Streams frames of noise through process_video() and checks every output
+// frame against the scalar kernels: Y4M and YUV420 sharpen the Y plane as is
+// and pass the chroma through, RGB24 goes through grayscale first.
+static bool video_matches(video_format format, int width, int height, int frames, int incremental_tile = 0) {
+    char header[80];
+    snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F30:1 Ip A1:1 C420jpeg", width, height);
+    size_t pixels = (size_t)width * height;
+    size_t chroma = format == VIDEO_RGB24 ? 0 : 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+    size_t frame_bytes = format == VIDEO_RGB24 ? pixels * 3 : pixels + chroma;
+    std::vector<uint8_t> stream = noise_frame(frame_bytes * frames, 1);
+
+    FILE* input = tmpfile();
+    FILE* output = tmpfile();
+    if (format == VIDEO_Y4M) {
+        fprintf(input, "%s\n", header);
+    }
+    for (int f = 0; f < frames; f++) {
+        if (format == VIDEO_Y4M) {
+            fputs("FRAME\n", input);
+        }
+        fwrite(&stream[frame_bytes * f], 1, frame_bytes, input);
+    }
+    rewind(input);
+
+    video_options options;
+    options.format = format;
+    options.width = format == VIDEO_Y4M ? 0 : width;
+    options.height = format == VIDEO_Y4M ? 0 : height;
+    options.incremental_tile = incremental_tile;
+    video_stats stats;
+    bool ok = process_video(input, output, options, stats) && stats.frames == frames;
 
-int main() {
+    std::vector<uint8_t> expected;
+    if (format == VIDEO_Y4M) {
+        expected.insert(expected.end(), header, header + strlen(header));
+        expected.push_back('\n');
+    }
+    for (int f = 0; f < frames; f++) {
+        const uint8_t* frame = &stream[frame_bytes * f];
+        std::vector<uint8_t> gray(frame, frame + pixels), filtered(pixels), sharpened(pixels);
+        if (format == VIDEO_RGB24) {
+            grayscale(frame, gray.data(), width, height);
+        }
+        laplacian(gray.data(), filtered.data(), width, height);
+        sharpen(gray.data(), filtered.data(), sharpened.data(), width, height);
+        if (format == VIDEO_Y4M) {
+            const char* marker = "FRAME\n";
+            expected.insert(expected.end(), marker, marker + 6);
+        }
+        expected.insert(expected.end(), sharpened.begin(), sharpened.end());
+        expected.insert(expected.end(), frame + pixels, frame + pixels + chroma);
+    }
+
+    std::vector<uint8_t> actual(expected.size() + 1);
+    rewind(output);
+    actual.resize(fread(actual.data(), 1, actual.size(), output));
+    fclose(input);
+    fclose(output);
+    if (!ok || actual != expected) {
+        std::cerr << "video stream (format " << format << ", " << width << "x" << height << ") differs" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// The incremental pipeline must match the whole-frame kernels frame after
+// frame: an unchanged frame recomputes no tile, a few changed pixels only the
+// tiles holding them, and a frame where every byte changed everything.
+static bool incremental_matches(bool rgb, int width, int height, int tile_size) {
+    int bytes_per_pixel = rgb ? 3 : 1;
+    // Low-contrast noise, so that the Laplacian does not saturate and a
+    // changed pixel shows up in its neighbours' outputs.
+    std::vector<uint8_t> frame = noise_frame(width, height);
+    frame.resize((size_t)width * height * bytes_per_pixel);
+    for (size_t i = 0; i < frame.size(); i++) {
+        frame[i] = 120 + (frame[i] & 15);
+    }
+    // Corners, the zeroed row/column, and pixels whose stencil reaches into a
+    // clean tile on each side.
+    const int changes[][2] = {{0, 0}, {width - 2, height - 2}, {width - 1, height - 1}, {tile_size, 2 * tile_size},
+                              {2 * tile_size, tile_size}, {tile_size - 1, 5}, {5, tile_size - 1}};
+    incremental_pipeline engine(tile_size);
+    int tiles_x = (width + tile_size - 1) / tile_size;
+
+    for (int f = 0; f < 4; f++) {
+        int expected_dirty = engine.tiles();
+        if (f == 2) {
+            std::vector<bool> touched(engine.tiles());
+            for (int i = 0; i < 7; i++) {
+                int x = changes[i][0], y = changes[i][1];
+                for (int c = 0; c < bytes_per_pixel; c++) {
+                    frame[((size_t)y * width + x) * bytes_per_pixel + c] = 0;
+                }
+                touched[(y / tile_size) * tiles_x + x / tile_size] = true;
+            }
+            expected_dirty = (int)std::count(touched.begin(), touched.end(), true);
+        } else if (f == 3) {
+            for (size_t i = 0; i < frame.size(); i++) {
+                frame[i] = 120 + ((frame[i] + 7) & 15);
+            }
+        }
+        engine.run(frame.data(), rgb, width, height);
+
+        reference_frames expected(width, height);
+        if (rgb) {
+            grayscale(frame.data(), expected.gray.data(), width, height);
+        } else {
+            expected.gray = frame;
+        }
+        laplacian(expected.gray.data(), expected.filtered.data(), width, height);
+        sharpen(expected.gray.data(), expected.filtered.data(), expected.sharpened.data(), width, height);
+
+        bool same = std::equal(expected.gray.begin(), expected.gray.end(), engine.grayscale()) &&
+                    std::equal(expected.filtered.begin(), expected.filtered.end(), engine.filtered()) &&
+                    std::equal(expected.sharpened.begin(), expected.sharpened.end(), engine.sharpened());
+        if (!same || (f == 1 && engine.dirty_tiles() != 0) || (f == 2 && engine.dirty_tiles() != expected_dirty) ||
+            (f != 1 && f != 2 && engine.dirty_tiles() != engine.tiles())) {
+            std::cerr << "incremental pipeline (" << (rgb ? "rgb" : "luma") << ", " << width << "x" << height
+                      << ", " << tile_size << " pixel tiles) differs on frame " << f << ": " << engine.dirty_tiles()
+                      << " of " << engine.tiles() << " tiles recomputed" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// A server thread on the CPU kernels and a client on its own mapping of the
+// same ring, with more jobs than slots so that slots are reused.
+static bool job_ring_matches(const std::vector<uint8_t>& rgb, int width, int height) {
+    char name[64];
+    snprintf(name, sizeof(name), "/laplacian_test_%d", (int)getpid());
+    job_ring server;
+    if (!server.create(name, 2, (size_t)width * height)) {
+        return false;
+    }
+    std::thread worker([&server]() {
+        for (int slot; (slot = server.next_job()) >= 0;) {
+            int w = server.width(slot), h = server.height(slot);
+            unsigned char* gray = server.output(slot, job_ring::GRAYSCALE);
+            unsigned char* filtered = server.output(slot, job_ring::FILTERED);
+            grayscale_simd(server.input(slot), gray, w, h);
+            laplacian_simd(gray, filtered, w, h);
+            sharpen_simd(gray, filtered, server.output(slot, job_ring::SHARPENED), w, h);
+            server.complete(slot, true);
+        }
+    });
+
+    std::vector<uint8_t> noise = noise_frame(37, 23);
+    job_ring client;
+    bool ok = client.open(name);
+    std::deque<std::pair<int, int> > pending;  // slot, job
+    for (int job = 0; ok && job < 7; job++) {
+        bool small = job % 2 == 1;
+        int w = small ? 37 : width, h = small ? 23 : height;
+        int slot = client.claim();
+        memcpy(client.input(slot), small ? noise.data() : rgb.data(), (size_t)w * h * 3);
+        ok = client.submit(slot, w, h);
+        pending.push_back(std::make_pair(slot, job));
+
+        // Check the oldest job once every slot is busy, and the rest at the end.
+        while (ok && (pending.size() == 2 || (job == 6 && !pending.empty()))) {
+            int done = pending.front().first, done_job = pending.front().second;
+            pending.pop_front();
+            bool done_small = done_job % 2 == 1;
+            int dw = done_small ? 37 : width, dh = done_small ? 23 : height;
+            reference_frames expected(dw, dh);
+            grayscale((done_small ? noise : rgb).data(), expected.gray.data(), dw, dh);
+            laplacian(expected.gray.data(), expected.filtered.data(), dw, dh);
+            sharpen(expected.gray.data(), expected.filtered.data(), expected.sharpened.data(), dw, dh);
+            ok = client.wait(done, 10000) &&
+                 std::equal(expected.gray.begin(), expected.gray.end(), client.grayscale(done)) &&
+                 std::equal(expected.filtered.begin(), expected.filtered.end(), client.filtered(done)) &&
+                 std::equal(expected.sharpened.begin(), expected.sharpened.end(), client.sharpened(done));
+            if (!ok) {
+                std::cerr << "job ring result of job " << done_job << " (" << dw << "x" << dh << ") differs"
+                          << std::endl;
+            }
+            client.release(done);
+        }
+    }
+
+    server.shutdown();
+    worker.join();
+
+    // A job that times out before the server takes it is withdrawn: its slot
+    // is free again, and the server skips it and still stops on shutdown.
+    job_ring idle;
+    char idle_name[64];
+    snprintf(idle_name, sizeof(idle_name), "/laplacian_test_idle_%d", (int)getpid());
+    if (ok && idle.create(idle_name, 1, 16)) {
+        int slot = idle.claim();
+        ok = idle.submit(slot, 4, 4) && !idle.wait(slot, 10);
+        idle.release(slot);
+        ok = ok && idle.claim() == slot;
+        idle.release(slot);
+        std::atomic<int> next(-2);
+        std::thread stale([&]() { next = idle.next_job(); });
+        usleep(20000);
+        idle.shutdown();
+        stale.join();
+        if (!ok || next != -1) {
+            std::cerr << "job ring did not withdraw a timed-out job" << std::endl;
+            ok = false;
+        }
+    }
+    if (ok && client.claim() != -1) {
+        std::cerr << "job ring still hands out slots after shutdown" << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+static bool same_file(const char* a, const char* b) {
+    std::ifstream fa(a, std::ios_base::binary), fb(b, std::ios_base::binary);
+    return fa && fb && std::equal(std::istreambuf_iterator<char>(fa), std::istreambuf_iterator<char>(),
+                                  std::istreambuf_iterator<char>(fb));
+}
+
+// Whether the top-down BMP top_down holds the rows of the bottom-up BMP
+// bottom_up: same header but for the negated height, rows in reverse order.
+static bool same_flipped(const char* top_down, const char* bottom_up) {
+    std::ifstream ft(top_down, std::ios_base::binary), fb(bottom_up, std::ios_base::binary);
+    std::vector<char> t((std::istreambuf_iterator<char>(ft)), std::istreambuf_iterator<char>());
+    std::vector<char> b((std::istreambuf_iterator<char>(fb)), std::istreambuf_iterator<char>());
+    if (t.size() != b.size() || t.size() < 54) {
+        return false;
+    }
+    int32_t offset, width, height;
+    int16_t bits;
+    memcpy(&offset, &b[10], 4);
+    memcpy(&width, &b[18], 4);
+    memcpy(&height, &b[22], 4);
+    memcpy(&bits, &b[28], 2);
+    size_t stride = ((size_t)width * bits / 8 + 3) & ~(size_t)3;
+    int32_t flipped_height = -height;
+    if (memcmp(&t[22], &flipped_height, 4) != 0 || !std::equal(t.begin(), t.begin() + 22, b.begin()) ||
+        !std::equal(t.begin() + 26, t.begin() + offset, b.begin() + 26)) {
+        return false;
+    }
+    for (int y = 0; y < height; y++) {
+        if (memcmp(&t[offset + y * stride], &b[offset + (height - 1 - y) * stride], stride) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void print_batch_stats(const batch_stats& stats) {
+    std::cout << stats.images << " images in " << stats.total_ms << " ms: " << stats.images_per_second()
+              << " images/s, " << stats.failed << " failed" << std::endl;
+    const char* names[2] = {"decoded", "computed"};
+    const batch_queue_stats* queues[2] = {&stats.decoded, &stats.computed};
+    for (int q = 0; q < 2; q++) {
+        std::cout << names[q] << " queue: mean occupancy " << queues[q]->mean_occupancy() << ", peak "
+                  << queues[q]->peak << ", producers blocked " << queues[q]->blocked_ms << " ms, consumers idle "
+                  << queues[q]->starved_ms << " ms" << std::endl;
+    }
+    std::cout << "frames: " << stats.frames.allocations << " mapped, " << stats.frames.reuses << " reused, peak "
+              << stats.frames.peak_mapped_bytes / 1024 << " KiB";
+    if (stats.frames.huge_fallbacks) {
+        std::cout << ", " << stats.frames.huge_fallbacks << " without huge pages";
+    }
+    std::cout << std::endl;
+    stats.stages.print(std::cout);
+}
+
+// Batch driver: laplacian_test --batch=<dir or list file> [--out=<dir>]
+// [--readers=<n>] [--workers=<n>] [--writers=<n>] [--queue=<n>]
+// [--pages=normal|thp|huge] [--populate]
+static int run_batch(int argc, char** argv) {
+    batch_options options;
+    const char* input = NULL;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 8, "--batch=") == 0) {
+            input = argv[i] + 8;
+        } else if (arg.compare(0, 6, "--out=") == 0) {
+            options.output_dir = arg.substr(6);
+        } else if (arg.compare(0, 10, "--readers=") == 0) {
+            options.readers = atoi(argv[i] + 10);
+        } else if (arg.compare(0, 10, "--workers=") == 0) {
+            options.workers = atoi(argv[i] + 10);
+        } else if (arg.compare(0, 10, "--writers=") == 0) {
+            options.writers = atoi(argv[i] + 10);
+        } else if (arg.compare(0, 8, "--queue=") == 0) {
+            options.queue_depth = atoi(argv[i] + 8);
+        } else if (arg == "--pages=normal") {
+            options.frames.pages = FRAME_PAGES_NORMAL;
+        } else if (arg == "--pages=thp") {
+            options.frames.pages = FRAME_PAGES_TRANSPARENT;
+        } else if (arg == "--pages=huge") {
+            options.frames.pages = FRAME_PAGES_HUGETLB;
+        } else if (arg == "--populate") {
+            options.frames.populate = true;
+        } else {
+            input = NULL;
+            break;
+        }
+    }
+    if (!input) {
+        std::cerr << "Usage: laplacian_test [--batch=<dir|list> [--out=<dir>] [--readers=<n>] [--workers=<n>]"
+                  << " [--writers=<n>] [--queue=<n>] [--pages=normal|thp|huge] [--populate]]" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> files;
+    if (!list_batch_inputs(input, files)) {
+        return 1;
+    }
+    batch_stats stats;
+    bool ok = process_batch(files, options, stats);
+    print_batch_stats(stats);
+    return ok ? 0 : 1;
+}
+
+// frame_pool must hand out aligned, writable buffers, serve released ones
+// again by size class and count both, with every page backing.
+// Huge pages the kernel could hand out to MAP_HUGETLB, reserved or overcommitted.
+static long huge_pages_available() {
+    long total = 0;
+    const char* files[2] = {"/proc/sys/vm/nr_hugepages", "/proc/sys/vm/nr_overcommit_hugepages"};
+    for (int i = 0; i < 2; i++) {
+        long pages = 0;
+        std::ifstream(files[i]) >> pages;
+        total += pages;
+    }
+    return total;
+}
+
+static bool frame_pool_matches() {
+    if (frame_pool::size_class(1) != 4096 || frame_pool::size_class(4096) != 4096 ||
+        frame_pool::size_class(5 * 4096 - 1) != 5 * 4096 || frame_pool::size_class(9 * 4096) != 10 * 4096 ||
+        frame_pool::size_class(17 * 4096) != 20 * 4096) {
+        std::cerr << "frame_pool size classes are wrong" << std::endl;
+        return false;
+    }
+    const frame_pages backings[3] = {FRAME_PAGES_NORMAL, FRAME_PAGES_TRANSPARENT, FRAME_PAGES_HUGETLB};
+    for (int b = 0; b < 3; b++) {
+        frame_pool_options options;
+        options.pages = backings[b];
+        options.populate = b == 1;
+        frame_pool pool(options);
+        uint8_t* first;
+        {
+            pooled_frame a(pool, 1283 * 37), c(pool, 37 * 23);
+            bool ok = a.data() && c.data() && (uintptr_t)a.data() % 4096 == 0 && (uintptr_t)c.data() % 4096 == 0;
+            if (ok) {
+                memset(a.data(), 0xa5, a.size());
+                memset(c.data(), 0x5a, c.size());
+            }
+            first = a.data();
+            if (!ok) {
+                std::cerr << "frame_pool returned an unaligned or no buffer" << std::endl;
+                return false;
+            }
+        }
+        // Most hosts reserve no huge pages, so MAP_HUGETLB fails: the pool
+        // must count the fallback and map just the size class in normal
+        // pages. A buffer that did get huge pages takes whole 2 MiB ones.
+        if (backings[b] == FRAME_PAGES_HUGETLB) {
+            const size_t huge_page = 2 << 20;
+            size_t first_class = frame_pool::size_class(1283 * 37), second_class = frame_pool::size_class(37 * 23);
+            frame_pool_stats stats = pool.stats();
+            bool ok;
+            if (stats.huge_fallbacks == 2) {
+                ok = stats.mapped_bytes == first_class + second_class;
+            } else if (stats.huge_fallbacks == 1) {
+                ok = stats.mapped_bytes == first_class + huge_page || stats.mapped_bytes == second_class + huge_page;
+            } else {
+                ok = stats.huge_fallbacks == 0 && stats.mapped_bytes == 2 * huge_page &&
+                     (uintptr_t)first % huge_page == 0;
+            }
+            if (!ok || (huge_pages_available() == 0 && stats.huge_fallbacks != 2)) {
+                std::cerr << "frame_pool counted " << stats.huge_fallbacks << " huge page fallbacks for "
+                          << stats.mapped_bytes << " mapped bytes" << std::endl;
+                return false;
+            }
+        }
+
+        // Same class as the first buffer, so it comes back without a new mapping.
+        pooled_frame again(pool, 1283 * 37 - 100);
+        frame_pool_stats stats = pool.stats();
+        bool ok = again.data() == first && stats.allocations == 2 && stats.reuses == 1 && stats.releases == 2 &&
+                  stats.cached_bytes > 0 && stats.peak_mapped_bytes >= stats.mapped_bytes;
+        again.reset();
+        pool.trim();
+        stats = pool.stats();
+        ok = ok && stats.mapped_bytes == 0 && stats.cached_bytes == 0;
+        if (!ok) {
+            std::cerr << "frame_pool with page backing " << b << " did not reuse or count its buffers" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// A directory with several copies of two images must give the same files as
+// the serial path, whatever the thread and queue sizes.
+static bool batch_matches(const char* rocks) {
+    char dir[] = "/tmp/laplacian_batch_XXXXXX";
+    if (!mkdtemp(dir)) {
+        std::cerr << "could not create a batch directory" << std::endl;
+        return false;
+    }
+    std::string base = dir, inputs = base + "/in", outputs = base + "/out";
+    mkdir(inputs.c_str(), 0700);
+    mkdir(outputs.c_str(), 0700);
+    std::vector<uint8_t> noise = noise_frame(37, 23), rgb;
     int width, height;
-    std::vector<ap_uint<8>> input_image;
+    readBMP(rocks, rgb, width, height);
+    std::vector<std::string> created;
+    for (int i = 0; i < 6; i++) {
+        created.push_back(inputs + "/image" + char('0' + i) + ".bmp");
+        if (i % 2) {
+            writeBMP(created.back().c_str(), noise, 37, 23);
+        } else {
+            writeBMP(created.back().c_str(), rgb, width, height);
+        }
+    }
+    created.push_back(inputs + "/broken.bmp");
+    std::ofstream(created.back().c_str()) << "not a bitmap";
+
+    reference_frames expected(37, 23);
+    grayscale(noise.data(), expected.gray.data(), 37, 23);
+    laplacian(expected.gray.data(), expected.filtered.data(), 37, 23);
+    sharpen(expected.gray.data(), expected.filtered.data(), expected.sharpened.data(), 37, 23);
+    std::string noise_outputs[3] = {base + "/noise_grey.bmp", base + "/noise_laplacian.bmp", base + "/noise_sharp.bmp"};
+    writeBMPGray8(noise_outputs[0].c_str(), expected.gray, 37, 23);
+    writeBMPGray8(noise_outputs[1].c_str(), expected.filtered, 37, 23);
+    writeBMPGray8(noise_outputs[2].c_str(), expected.sharpened, 37, 23);
+
+    const char* suffixes[3] = {"_grey.bmp", "_laplacian.bmp", "_sharp.bmp"};
+    auto remove_outputs = [&]() {
+        for (int i = 0; i < 6; i++) {
+            for (int k = 0; k < 3; k++) {
+                remove((outputs + "/image" + char('0' + i) + suffixes[k]).c_str());
+            }
+        }
+    };
+    const int shapes[][4] = {{1, 1, 1, 1}, {2, 3, 2, 2}, {3, 0, 1, 1}};
+    bool ok = true;
+    for (int s = 0; s < 3 && ok; s++) {
+        remove_outputs();
+        batch_options options;
+        options.output_dir = outputs;
+        options.readers = shapes[s][0];
+        options.workers = shapes[s][1];
+        options.writers = shapes[s][2];
+        options.queue_depth = shapes[s][3];
+        std::vector<std::string> files;
+        batch_stats stats;
+        ok = list_batch_inputs(inputs.c_str(), files) && files.size() == 7 && !process_batch(files, options, stats) &&
+             stats.images == 6 && stats.failed == 1 && stats.decoded.peak <= options.queue_depth &&
+             stats.computed.peak <= options.queue_depth;
+        const char* serial[3] = {"/home/jam/Downloads/Laplacian/src/grey.bmp",
+                                 "/home/jam/Downloads/Laplacian/src/laplacian.bmp",
+                                 "/home/jam/Downloads/Laplacian/src/sharp.bmp"};
+        for (int i = 0; i < 6 && ok; i++) {
+            for (int k = 0; k < 3 && ok; k++) {
+                std::string output = outputs + "/image" + char('0' + i) + suffixes[k];
+                ok = same_file(output.c_str(), i % 2 ? noise_outputs[k].c_str() : serial[k]);
+            }
+        }
+        if (!ok) {
+            std::cerr << "batch with " << options.readers << " readers, " << options.workers << " workers, "
+                      << options.writers << " writers and a queue of " << options.queue_depth << " differs"
+                      << std::endl;
+        }
+    }
+
+    for (size_t i = 0; i < created.size(); i++) {
+        remove(created[i].c_str());
+    }
+    for (int k = 0; k < 3; k++) {
+        remove(noise_outputs[k].c_str());
+    }
+    remove_outputs();
+    rmdir(inputs.c_str());
+    rmdir(outputs.c_str());
+    rmdir(dir);
+    return ok;
+}
+
+#endif
+
+// stencil_filter() against a plain multiply-accumulate over the same
+// coefficients, listed row by row in taps.
+template <typename stencil_t>
+static bool stencil_matches(const char* name, const int* taps, const std::vector<pixel_t>& gray,
+                            int width, int height) {
+    const int K = stencil_t::size;
+    const int R = K / 2;
+    std::vector<pixel_t> filtered(width * height);
+    stencil_filter<stencil_t>(gray.data(), filtered.data(), width, height);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int expected = 0;
+            if (y >= R && x >= R && y < height - R && x < width - R) {
+                for (int ky = 0; ky < K; ky++) {
+                    for (int kx = 0; kx < K; kx++) {
+                        expected += taps[ky * K + kx] * (int)gray[(y + ky - R) * width + (x + kx - R)];
+                    }
+                }
+            }
+            expected = expected < 0 ? 0 : (expected > 255 ? 255 : expected);
+            if ((int)filtered[y * width + x] != expected) {
+                std::cerr << "stencil_filter<" << name << "> differs at (" << x << ", " << y << ") of a "
+                          << width << "x" << height << " frame" << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// unsharp() with amount num / 2^shift against the formula.
+template <int NUM, int SHIFT>
+static bool unsharp_matches(const std::vector<pixel_t>& gray, const std::vector<pixel_t>& filtered) {
+    std::vector<pixel_t> sharpened(gray.size());
+    unsharp<unsharp_amount<NUM, SHIFT> >(gray.data(), filtered.data(), sharpened.data(), (int)gray.size(), 1);
+    for (size_t i = 0; i < gray.size(); i++) {
+        int expected = (int)gray[i] + (((int)filtered[i] * NUM) >> SHIFT);
+        expected = expected > 255 ? 255 : expected;
+        if ((int)sharpened[i] != expected) {
+            std::cerr << "unsharp with amount " << NUM << "/" << (1 << SHIFT) << " differs" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool stencils_match(const std::vector<pixel_t>& gray, int width, int height) {
+    const int laplacian4_taps[] = {0, -1, 0, -1, 4, -1, 0, -1, 0};
+    const int laplacian8_taps[] = {-1, -1, -1, -1, 8, -1, -1, -1, -1};
+    const int log5_taps[] = {0, 0, -1, 0, 0, 0, -1, -2, -1, 0, -1, -2, 16, -2, -1, 0, -1, -2, -1, 0, 0, 0, -1, 0, 0};
+    return stencil_matches<laplacian4>("laplacian4", laplacian4_taps, gray, width, height) &&
+           stencil_matches<laplacian8>("laplacian8", laplacian8_taps, gray, width, height) &&
+           stencil_matches<laplacian_of_gaussian5>("laplacian_of_gaussian5", log5_taps, gray, width, height);
+}
+
+// Bands spread over K units, each running laplacian_sharpen_band() on the CPU
+// in place of a compute unit, must assemble the same frames as one
+// laplacian_sharpen() per frame, for single frames and for batches.
+static bool bands_match(const std::vector<pixel_t>& rgb, int width, int height) {
+    std::vector<pixel_t> noise = noise_frame(37, 23);
+    const std::vector<pixel_t>* inputs[3] = {&rgb, &noise, &rgb};
+    const int widths[3] = {width, 37, width};
+    const int heights[3] = {height, 23, height};
+
+    std::vector<pixel_t> expected[3][3];
+    for (int i = 0; i < 3; i++) {
+        size_t pixels = (size_t)widths[i] * heights[i];
+        for (int k = 0; k < 3; k++) {
+            expected[i][k].resize(pixels);
+        }
+        laplacian_sharpen(inputs[i]->data(), expected[i][2].data(), expected[i][0].data(), expected[i][1].data(),
+                          true, true, widths[i], heights[i]);
+    }
+
+    const int units[] = {1, 2, 3, 5};
+    const int band_rows[] = {0, 1, 7};
+    for (int u = 0; u < 4; u++) {
+        band_scheduler scheduler(units[u]);
+        long planned = 0;
+        for (int b = 0; b < 3; b++) {
+            for (int count = 1; count <= 3; count += 2) {
+                std::vector<pixel_t> actual[3][3];
+                for (int i = 0; i < count; i++) {
+                    for (int k = 0; k < 3; k++) {
+                        actual[i][k].assign(expected[i][k].size(), pixel_t(0));
+                    }
+                }
+                std::vector<frame_band> bands = scheduler.plan(heights, count, band_rows[b]);
+                planned += bands.size();
+                scheduler.run(bands, [&](int, const frame_band& band) {
+                    int i = band.image;
+                    laplacian_sharpen_band(inputs[i]->data(), actual[i][2].data(), actual[i][0].data(),
+                                           actual[i][1].data(), true, true, widths[i], heights[i], band.first_row,
+                                           band.rows);
+                });
+                for (int i = 0; i < count; i++) {
+                    if (actual[i][0] != expected[i][0] || actual[i][1] != expected[i][1] ||
+                        actual[i][2] != expected[i][2]) {
+                        std::cerr << count << " frames in " << bands.size() << " bands on " << units[u]
+                                  << " units differ from whole frames (image " << i << ")" << std::endl;
+                        return false;
+                    }
+                }
+            }
+        }
+        long total = 0;
+        for (int unit = 0; unit < scheduler.units(); unit++) {
+            total += scheduler.unit_bands()[unit];
+        }
+        if (total != planned) {
+            std::cerr << "band scheduler ran " << total << " of " << planned << " bands" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Statistics gathered inside the fused pass, whole-frame, merged from bands
+// and (on the host) from every SIMD level, must equal those read back from
+// the frames the separate kernels write.
+static bool stats_match(const std::vector<pixel_t>& rgb, int width, int height) {
+    size_t pixels = (size_t)width * height;
+    std::vector<pixel_t> gray(pixels), filtered(pixels), sharpened(pixels);
+    grayscale(rgb.data(), gray.data(), width, height);
+    laplacian(gray.data(), filtered.data(), width, height);
+    sharpen(gray.data(), filtered.data(), sharpened.data(), width, height);
+    image_stats expected;
+    image_stats_clear(expected);
+    for (size_t i = 0; i < pixels; i++) {
+        int f = filtered[i];
+        expected.histogram[(int)gray[i]]++;
+        expected.laplacian_sum += f;
+        expected.laplacian_sum_squares += f * f;
+        expected.clipped += (int)gray[i] + f > 255;
+    }
+    expected.pixels = (uint32_t)pixels;
+    auto same = [&](const image_stats& actual) {
+        return memcmp(actual.histogram, expected.histogram, sizeof(expected.histogram)) == 0 &&
+               actual.laplacian_sum == expected.laplacian_sum &&
+               actual.laplacian_sum_squares == expected.laplacian_sum_squares &&
+               actual.clipped == expected.clipped && actual.pixels == expected.pixels;
+    };
+
+    std::vector<pixel_t> fused_gray(pixels), fused_filtered(pixels), fused_sharpened(pixels);
+    image_stats whole;
+    laplacian_sharpen_stats(rgb.data(), fused_sharpened.data(), fused_gray.data(), fused_filtered.data(), true, true,
+                            width, height, whole);
+    if (!same(whole) || fused_gray != gray || fused_filtered != filtered || fused_sharpened != sharpened) {
+        std::cerr << "laplacian_sharpen_stats differs on a " << width << "x" << height << " frame" << std::endl;
+        return false;
+    }
+
+    const int band_rows[] = {1, 7, 100};
+    for (int b = 0; b < 3; b++) {
+        image_stats merged;
+        image_stats_clear(merged);
+        for (int first_row = 0; first_row < height; first_row += band_rows[b]) {
+            image_stats band;
+            int rows = std::min(band_rows[b], height - first_row);
+            laplacian_sharpen_stats_band(rgb.data(), fused_sharpened.data(), fused_gray.data(),
+                                         fused_filtered.data(), false, false, width, height, first_row, rows, band);
+            image_stats_merge(merged, band);
+        }
+        if (!same(merged)) {
+            std::cerr << "statistics merged from bands of " << band_rows[b] << " rows differ" << std::endl;
+            return false;
+        }
+    }
+
+#ifdef HOST_ONLY
+    for (int level = SIMD_SCALAR; level <= simd_best(); level++) {
+        image_stats actual;
+        std::fill(fused_gray.begin(), fused_gray.end(), 0);
+        std::fill(fused_filtered.begin(), fused_filtered.end(), 0);
+        std::fill(fused_sharpened.begin(), fused_sharpened.end(), 0);
+        laplacian_sharpen_stats_simd(rgb.data(), fused_gray.data(), fused_filtered.data(), fused_sharpened.data(),
+                                     width, height, actual, simd_level(level));
+        if (!same(actual) || fused_gray != gray || fused_filtered != filtered || fused_sharpened != sharpened) {
+            std::cerr << simd_level_name(simd_level(level)) << " laplacian_sharpen_stats_simd differs on a "
+                      << width << "x" << height << " frame" << std::endl;
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+#ifndef HOST_ONLY
+// Packs a byte frame into zero-padded 512-bit words and back.
+static std::vector<wide_t> to_words(const std::vector<pixel_t>& frame) {
+    std::vector<wide_t> words(WIDE_WORDS(frame.size()));
+    for (size_t i = 0; i < frame.size(); i++) {
+        words[i / WIDE_BYTES].range(8 * (i % WIDE_BYTES) + 7, 8 * (i % WIDE_BYTES)) = frame[i];
+    }
+    return words;
+}
+
+static std::vector<pixel_t> from_words(const std::vector<wide_t>& words, size_t bytes) {
+    std::vector<pixel_t> frame(bytes);
+    for (size_t i = 0; i < bytes; i++) {
+        frame[i] = words[i / WIDE_BYTES].range(8 * (i % WIDE_BYTES) + 7, 8 * (i % WIDE_BYTES));
+    }
+    return frame;
+}
+
+// The N-pixels-per-clock wide-bus kernels must match the scalar kernels.
+template <int N>
+static bool wide_matches(const std::vector<pixel_t>& rgb, int width, int height) {
+    std::vector<pixel_t> gray(width * height), filtered(width * height), sharpened(width * height);
+    grayscale(rgb.data(), gray.data(), width, height);
+    laplacian(gray.data(), filtered.data(), width, height);
+    sharpen(gray.data(), filtered.data(), sharpened.data(), width, height);
+
+    std::vector<wide_t> rgb_words = to_words(rgb);
+    std::vector<wide_t> gray_words(WIDE_WORDS(width * height));
+    std::vector<wide_t> filtered_words(gray_words.size()), sharpened_words(gray_words.size());
+    grayscale_wide<N>(rgb_words.data(), gray_words.data(), width, height);
+    laplacian_wide<N>(gray_words.data(), filtered_words.data(), width, height);
+    sharpen_wide<N>(gray_words.data(), filtered_words.data(), sharpened_words.data(), width, height);
+
+    if (from_words(gray_words, width * height) != gray || from_words(filtered_words, width * height) != filtered ||
+        from_words(sharpened_words, width * height) != sharpened) {
+        std::cerr << "wide kernels with " << N << " pixels per clock differ on a " << width << "x" << height
+                  << " frame" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <int N>
+static bool wide_matches_all(const std::vector<pixel_t>& rgb, int width, int height) {
+    return wide_matches<N>(rgb, width, height) && wide_matches<N>(noise_frame(37, 23), 37, 23) &&
+           wide_matches<N>(noise_frame(5, 4), 5, 4);
+}
+#endif
+
+int main(int argc, char** argv) {
+#ifdef HOST_ONLY
+    if (argc > 1) {
+        return run_batch(argc, argv);
+    }
+#endif
+    int width, height;
+    std::vector<pixel_t> input_image;
     readBMP("/home/jam/Downloads/Laplacian/src/rocks.bmp", input_image, width, height);
 
-    std::vector<ap_uint<8>> output_image(width * height);
-    std::vector<ap_uint<8>> padded((width + 2) * (height + 2), 0);
-    std::vector<ap_uint<8>> filtered_output(width * height);
-    std::vector<ap_uint<8>> sharpened_output(width * height);
+    std::vector<pixel_t> output_image(width * height);
+    std::vector<pixel_t> filtered_output(width * height);
+    std::vector<pixel_t> sharpened_output(width * height);
+
+    // Per-stage CPU time of the kernels, reported at the end.
+    stage_profile profile;
+    const size_t pixels = (size_t)width * height;
 
     // Perform grayscale conversion
-    grayscale(input_image.data(), output_image.data(), width, height);
-    writeBMPGray("/home/jam/Downloads/Laplacian/src/grey.bmp", output_image, width, height);
+    {
+        stage_timer timer(&profile, "grayscale", pixels, pixels * 4);
+        grayscale(input_image.data(), output_image.data(), width, height);
+    }
+    writeBMPGray8("/home/jam/Downloads/Laplacian/src/grey.bmp", output_image, width, height);
 
     // Perform Laplacian filtering
-    laplacian(output_image.data(), padded.data(), filtered_output.data(), width, height);
-    writeBMPGray("/home/jam/Downloads/Laplacian/src/laplacian.bmp", filtered_output, width, height);
+    {
+        stage_timer timer(&profile, "laplacian", pixels, pixels * 2);
+        laplacian(output_image.data(), filtered_output.data(), width, height);
+    }
+    writeBMPGray8("/home/jam/Downloads/Laplacian/src/laplacian.bmp", filtered_output, width, height);
 
     // Perform sharpening
-    sharpen(output_image.data(), filtered_output.data(), sharpened_output.data(), width, height);
-    writeBMPGray("/home/jam/Downloads/Laplacian/src/sharp.bmp", sharpened_output, width, height);
+    {
+        stage_timer timer(&profile, "sharpen", pixels, pixels * 3);
+        sharpen(output_image.data(), filtered_output.data(), sharpened_output.data(), width, height);
+    }
+    writeBMPGray8("/home/jam/Downloads/Laplacian/src/sharp.bmp", sharpened_output, width, height);
+
+    // The fused dataflow top must reproduce all three frames
+    std::vector<pixel_t> fused_gray(width * height);
+    std::vector<pixel_t> fused_filtered(width * height);
+    std::vector<pixel_t> fused_sharpened(width * height);
+    {
+        stage_timer timer(&profile, "laplacian_sharpen", pixels, pixels * 6);
+        laplacian_sharpen(input_image.data(), fused_sharpened.data(), fused_gray.data(), fused_filtered.data(),
+                          true, true, width, height);
+    }
+    if (fused_gray != output_image || fused_filtered != filtered_output || fused_sharpened != sharpened_output) {
+        std::cerr << "laplacian_sharpen output differs from the separate kernels" << std::endl;
+        return 1;
+    }
+
+    // The compile-time stencils and unsharp amounts.
+    std::vector<pixel_t> noise_gray(37 * 23);
+    grayscale(noise_frame(37, 23).data(), noise_gray.data(), 37, 23);
+    if (!stencils_match(output_image, width, height) || !stencils_match(noise_gray, 37, 23) ||
+        !stencils_match(std::vector<pixel_t>(noise_gray.begin(), noise_gray.begin() + 20), 5, 4)) {
+        return 1;
+    }
+    if (!unsharp_matches<1, 1>(output_image, filtered_output) || !unsharp_matches<1, 0>(output_image, filtered_output) ||
+        !unsharp_matches<3, 1>(output_image, filtered_output) || !unsharp_matches<2, 0>(output_image, filtered_output)) {
+        return 1;
+    }
+    if (!bands_match(input_image, width, height)) {
+        return 1;
+    }
+    if (!stats_match(input_image, width, height) || !stats_match(noise_frame(1283, 37), 1283, 37) ||
+        !stats_match(noise_frame(5, 4), 5, 4)) {
+        return 1;
+    }
+
+#ifndef HOST_ONLY
+    if (!wide_matches_all<1>(input_image, width, height) || !wide_matches_all<2>(input_image, width, height) ||
+        !wide_matches_all<4>(input_image, width, height) || !wide_matches_all<8>(input_image, width, height) ||
+        !wide_matches_all<16>(input_image, width, height)) {
+        return 1;
+    }
+#endif
+
+#ifdef HOST_ONLY
+    // 7680 is wider than MAX_WIDTH, which only bounds the synthesised kernels.
+    if (!simd_matches(input_image, width, height) || !simd_matches(noise_frame(1283, 37), 1283, 37) ||
+        !simd_matches(noise_frame(5, 4), 5, 4) || !simd_matches(noise_frame(7680, 8), 7680, 8)) {
+        return 1;
+    }
+    if (!tiled_matches(input_image, width, height) || !tiled_matches(noise_frame(1283, 37), 1283, 37)) {
+        return 1;
+    }
+    // Checkerboard rows 600000 pixels wide, half of them Laplacian 255s, would
+    // wrap 32-bit square lanes that are not flushed into the 64-bit total.
+    std::vector<pixel_t> checker(600000 * 6 * 3);
+    for (size_t i = 0; i < checker.size(); i++) {
+        size_t pixel = i / 3;
+        checker[i] = (pixel % 600000 + pixel / 600000) % 2 ? 255 : 0;
+    }
+    if (!stats_match(checker, 600000, 6)) {
+        return 1;
+    }
+
+    // Mapped input, bottom-up and top-down, must give the same frames.
+    write_top_down("/home/jam/Downloads/Laplacian/src/rocks.bmp", "/home/jam/Downloads/Laplacian/src/rocks_topdown.bmp");
+    std::vector<uint8_t> top_down;
+    int top_down_width, top_down_height;
+    readBMP("/home/jam/Downloads/Laplacian/src/rocks_topdown.bmp", top_down, top_down_width, top_down_height);
+    if (top_down != input_image || !mapped_matches("/home/jam/Downloads/Laplacian/src/rocks.bmp", sharpened_output) ||
+        !mapped_matches("/home/jam/Downloads/Laplacian/src/rocks_topdown.bmp", sharpened_output)) {
+        std::cerr << "mapped or top-down BMP input differs" << std::endl;
+        return 1;
+    }
+    if (!bad_headers_rejected()) {
+        return 1;
+    }
+
+    if (!video_matches(VIDEO_Y4M, 37, 23, 3) || !video_matches(VIDEO_YUV420, 37, 23, 2) ||
+        !video_matches(VIDEO_RGB24, 37, 23, 2) || !video_matches(VIDEO_Y4M, 37, 23, 3, 8)) {
+        return 1;
+    }
+    if (!incremental_matches(true, 37, 23, 8) || !incremental_matches(false, 37, 23, 8) ||
+        !incremental_matches(false, 1283, 37, 16) || !incremental_matches(true, 321, 481, 32)) {
+        return 1;
+    }
+    if (!job_ring_matches(input_image, width, height)) {
+        return 1;
+    }
+
+    // Strip-mined processing must write the same files as the in-memory path.
+    const int strip_sizes[] = {1, 7, 1000};
+    for (int i = 0; i < 3; i++) {
+        strip_options options;
+        options.strip_rows = strip_sizes[i];
+        if (!process_bmp_strips("/home/jam/Downloads/Laplacian/src/rocks.bmp",
+                                "/home/jam/Downloads/Laplacian/src/sharp_strips.bmp",
+                                "/home/jam/Downloads/Laplacian/src/grey_strips.bmp",
+                                "/home/jam/Downloads/Laplacian/src/laplacian_strips.bmp", options) ||
+            !same_file("/home/jam/Downloads/Laplacian/src/sharp_strips.bmp", "/home/jam/Downloads/Laplacian/src/sharp.bmp") ||
+            !same_file("/home/jam/Downloads/Laplacian/src/grey_strips.bmp", "/home/jam/Downloads/Laplacian/src/grey.bmp") ||
+            !same_file("/home/jam/Downloads/Laplacian/src/laplacian_strips.bmp",
+                       "/home/jam/Downloads/Laplacian/src/laplacian.bmp")) {
+            std::cerr << "strip-mined output with " << strip_sizes[i] << " rows per strip differs" << std::endl;
+            return 1;
+        }
+    }
+    // A top-down input gives top-down outputs holding the same rows.
+    if (!process_bmp_strips("/home/jam/Downloads/Laplacian/src/rocks_topdown.bmp",
+                            "/home/jam/Downloads/Laplacian/src/sharp_strips.bmp",
+                            "/home/jam/Downloads/Laplacian/src/grey_strips.bmp",
+                            "/home/jam/Downloads/Laplacian/src/laplacian_strips.bmp") ||
+        !same_flipped("/home/jam/Downloads/Laplacian/src/sharp_strips.bmp", "/home/jam/Downloads/Laplacian/src/sharp.bmp") ||
+        !same_flipped("/home/jam/Downloads/Laplacian/src/grey_strips.bmp", "/home/jam/Downloads/Laplacian/src/grey.bmp") ||
+        !same_flipped("/home/jam/Downloads/Laplacian/src/laplacian_strips.bmp",
+                      "/home/jam/Downloads/Laplacian/src/laplacian.bmp")) {
+        std::cerr << "strip-mined output from the top-down input differs" << std::endl;
+        return 1;
+    }
+    if (!frame_pool_matches() || !batch_matches("/home/jam/Downloads/Laplacian/src/rocks.bmp")) {
+        return 1;
+    }
+#endif
+
+    profile.print(std::cout);
+    std::ofstream profile_json("/home/jam/Downloads/Laplacian/src/profile.json");
+    profile.write_json(profile_json);
+
+    // The float and float-exact grayscale must match the float formula
+    // exactly; a GRAYSCALE_FIXED build only reports how far it is off.
+    if (grayscale_sweep() != 0 && GRAYSCALE_MODE != GRAYSCALE_FIXED) {
+        return 1;
+    }
 
     return 0;
 }
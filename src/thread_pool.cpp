@@ -0,0 +1,101 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+thread_pool::thread_pool(int threads)
+    : queues(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+      job(0), generation(0), busy(0), stopping(false) {
+    for (int worker = 1; worker < size(); worker++) {
+        workers.push_back(std::thread(&thread_pool::worker_loop, this, worker));
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        stopping = true;
+    }
+    start.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+void thread_pool::run(int tasks, const std::function<void(int, int)>& fn) {
+    for (int worker = 0; worker < size(); worker++) {
+        std::lock_guard<std::mutex> guard(queues[worker].lock);
+        for (int task = (long long)tasks * worker / size(); task < (long long)tasks * (worker + 1) / size(); task++) {
+            queues[worker].tasks.push_back(task);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        job = &fn;
+        generation++;
+    }
+    start.notify_all();
+
+    int task;
+    while (next_task(0, task)) {
+        fn(task, 0);
+    }
+
+    // The queues are empty now; wait for workers still inside a task. Clearing
+    // job under the same lock keeps late wakers from picking up a stale batch.
+    std::unique_lock<std::mutex> guard(state_lock);
+    done.wait(guard, [this] { return busy == 0; });
+    job = 0;
+}
+
+void thread_pool::worker_loop(int worker) {
+    unsigned seen = 0;
+    for (;;) {
+        const std::function<void(int, int)>* fn;
+        {
+            std::unique_lock<std::mutex> guard(state_lock);
+            start.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            fn = job;
+            if (!fn) {
+                continue;
+            }
+            busy++;
+        }
+
+        int task;
+        while (next_task(worker, task)) {
+            (*fn)(task, worker);
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(state_lock);
+            busy--;
+        }
+        done.notify_all();
+    }
+}
+
+bool thread_pool::next_task(int worker, int& task) {
+    {
+        task_queue& own = queues[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    for (int i = 1; i < size(); i++) {
+        task_queue& victim = queues[(worker + i) % size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
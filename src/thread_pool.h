@@ -0,0 +1,48 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run batches of independent tasks.
+// Each batch is split into contiguous runs, one per worker deque; a worker
+// that drains its own deque steals from the back of the others', so uneven
+// tasks still balance. The calling thread takes part as worker 0.
+class thread_pool {
+public:
+    // threads <= 0 means one per hardware thread.
+    explicit thread_pool(int threads = 0);
+    ~thread_pool();
+
+    int size() const { return (int)queues.size(); }
+
+    // Calls fn(task, worker) for every task in [0, tasks) and returns once all
+    // of them have finished. worker is in [0, size()).
+    void run(int tasks, const std::function<void(int, int)>& fn);
+
+private:
+    struct task_queue {
+        std::mutex lock;
+        std::deque<int> tasks;
+    };
+
+    void worker_loop(int worker);
+    bool next_task(int worker, int& task);
+
+    std::vector<task_queue> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex state_lock;
+    std::condition_variable start;
+    std::condition_variable done;
+    const std::function<void(int, int)>* job;
+    unsigned generation;
+    int busy;
+    bool stopping;
+};
+
+#endif
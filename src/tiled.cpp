@@ -0,0 +1,66 @@
+#include "tiled.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Rough L2 budget per band: RGB input, grayscale with halo, filtered and output.
+#define TILE_L2_BYTES (256 * 1024)
+#define TILE_BYTES_PER_PIXEL 6
+
+tiled_engine::tiled_engine(const tiled_options& options)
+    : options(options), pool(options.threads), scratch(pool.size()) {}
+
+void tiled_engine::run(const uint8_t* input_image, uint8_t* sharpened_output, uint8_t* grayscale_output,
+                       uint8_t* filtered_output, int width, int height) {
+    run(input_image, (ptrdiff_t)width * 3, sharpened_output, grayscale_output, filtered_output, width, height);
+}
+
+void tiled_engine::run(const uint8_t* input_image, ptrdiff_t input_stride, uint8_t* sharpened_output,
+                       uint8_t* grayscale_output, uint8_t* filtered_output, int width, int height) {
+    int tile_rows = options.tile_rows;
+    if (tile_rows <= 0) {
+        tile_rows = std::max(1, TILE_L2_BYTES / (TILE_BYTES_PER_PIXEL * width));
+    }
+    int bands = (height + tile_rows - 1) / tile_rows;
+
+    pool.run(bands, [&](int band, int worker) {
+        int y0 = band * tile_rows;
+        int y1 = std::min(height, y0 + tile_rows);
+        run_band(worker, input_image, input_stride, sharpened_output, grayscale_output, filtered_output, width, height,
+                 y0, y1);
+    });
+}
+
+void tiled_engine::run_band(int worker, const uint8_t* input_image, ptrdiff_t input_stride,
+                            uint8_t* sharpened_output, uint8_t* grayscale_output, uint8_t* filtered_output,
+                            int width, int height, int y0, int y1) {
+    // Grayscale rows g0..g1-1 are the band plus its halo.
+    int g0 = std::max(0, y0 - 1);
+    int g1 = std::min(height, y1 + 1);
+    int rows = y1 - y0;
+
+    std::vector<uint8_t>& buffer = scratch[worker];
+    buffer.resize((size_t)width * ((g1 - g0) + rows));
+    uint8_t* gray = buffer.data();
+    uint8_t* filtered = filtered_output ? filtered_output + (size_t)y0 * width : gray + (size_t)width * (g1 - g0);
+
+    if (input_stride == (ptrdiff_t)width * 3) {
+        grayscale_simd(input_image + g0 * input_stride, gray, width, g1 - g0, options.level);
+    } else {
+        for (int y = g0; y < g1; y++) {
+            grayscale_simd(input_image + y * input_stride, gray + (size_t)(y - g0) * width, width, 1, options.level);
+        }
+    }
+
+    for (int y = y0; y < y1; y++) {
+        const uint8_t* row = gray + (size_t)(y - g0) * width;
+        laplacian_row_simd(y > 0 ? row - width : 0, row, y < height - 1 ? row + width : 0,
+                           filtered + (size_t)(y - y0) * width, y, width, height, options.level);
+    }
+
+    const uint8_t* band_gray = gray + (size_t)(y0 - g0) * width;
+    sharpen_simd(band_gray, filtered, sharpened_output + (size_t)y0 * width, width, rows, options.level);
+    if (grayscale_output) {
+        memcpy(grayscale_output + (size_t)y0 * width, band_gray, (size_t)width * rows);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef TILED_H
+#define TILED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "simd.h"
+#include "thread_pool.h"
+
+struct tiled_options {
+    int threads;       // worker threads; 0 means one per hardware thread
+    int tile_rows;     // rows per band; 0 sizes a band's working set to fit in L2
+    simd_level level;  // kernel implementation used inside each band
+
+    tiled_options() : threads(0), tile_rows(0), level(simd_best()) {}
+};
+
+// Multi-threaded host pipeline. The frame is cut into row bands; each band
+// converts its rows plus a one-row halo above and below to grayscale, then
+// runs the Laplacian and sharpen on its own rows, so bands never wait on each
+// other. The output is identical to running the kernels over the whole frame.
+class tiled_engine {
+public:
+    explicit tiled_engine(const tiled_options& options = tiled_options());
+
+    int threads() const { return pool.size(); }
+
+    // Same contract as laplacian_sharpen(): grayscale_output and
+    // filtered_output are written only when non-null.
+    void run(const uint8_t* input_image, uint8_t* sharpened_output, uint8_t* grayscale_output,
+             uint8_t* filtered_output, int width, int height);
+
+    // Same, but RGB row y starts at input_image + y * input_stride, so padded
+    // or top-down rows (e.g. a mapped BMPView) are read in place.
+    void run(const uint8_t* input_image, ptrdiff_t input_stride, uint8_t* sharpened_output,
+             uint8_t* grayscale_output, uint8_t* filtered_output, int width, int height);
+
+private:
+    void run_band(int worker, const uint8_t* input_image, ptrdiff_t input_stride, uint8_t* sharpened_output,
+                  uint8_t* grayscale_output, uint8_t* filtered_output, int width, int height, int y0, int y1);
+
+    tiled_options options;
+    thread_pool pool;
+    std::vector<std::vector<uint8_t> > scratch;  // per worker
+};
+
+#endif
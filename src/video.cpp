@@ -0,0 +1,154 @@
+#include "video.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "incremental.h"
+#include "profile.h"
+
+// Reads up to and including the next newline; false at end of input.
+static bool read_line(FILE* input, std::string& line) {
+    line.clear();
+    int c;
+    while ((c = fgetc(input)) != EOF) {
+        if (c == '\n')
+            return true;
+        line += (char)c;
+    }
+    return !line.empty();
+}
+
+// Parses a YUV4MPEG2 stream header; chroma_bytes is the size of both chroma
+// planes of one frame.
+static bool parse_y4m_header(const std::string& header, int& width, int& height, size_t& chroma_bytes) {
+    if (header.compare(0, 10, "YUV4MPEG2 ") != 0) {
+        fprintf(stderr, "Error: not a YUV4MPEG2 stream\n");
+        return false;
+    }
+    std::string colorspace = "420jpeg";
+    width = height = 0;
+    size_t start = 10;
+    while (start < header.size()) {
+        size_t end = header.find(' ', start);
+        if (end == std::string::npos)
+            end = header.size();
+        std::string token = header.substr(start, end - start);
+        if (!token.empty()) {
+            if (token[0] == 'W') {
+                width = atoi(token.c_str() + 1);
+            } else if (token[0] == 'H') {
+                height = atoi(token.c_str() + 1);
+            } else if (token[0] == 'C') {
+                colorspace = token.substr(1);
+            }
+        }
+        start = end + 1;
+    }
+    if (width < 1 || height < 1) {
+        fprintf(stderr, "Error: Y4M header has no frame size\n");
+        return false;
+    }
+
+    size_t half_width = (width + 1) / 2, half_height = (height + 1) / 2;
+    if (colorspace == "420" || colorspace == "420jpeg" || colorspace == "420mpeg2" || colorspace == "420paldv") {
+        chroma_bytes = 2 * half_width * half_height;
+    } else if (colorspace == "422") {
+        chroma_bytes = 2 * half_width * height;
+    } else if (colorspace == "444") {
+        chroma_bytes = 2 * (size_t)width * height;
+    } else if (colorspace == "mono") {
+        chroma_bytes = 0;
+    } else {
+        fprintf(stderr, "Error: unsupported Y4M colorspace C%s (8-bit only)\n", colorspace.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool process_video(FILE* input, FILE* output, const video_options& options, video_stats& stats) {
+    double start = profile_now_ms();
+    int width = options.width, height = options.height;
+    size_t chroma_bytes = 0;
+    std::string line;
+
+    stats = video_stats();
+    if (options.format == VIDEO_Y4M) {
+        if (!read_line(input, line) || !parse_y4m_header(line, width, height, chroma_bytes)) {
+            return false;
+        }
+        // Same stream parameters out as in.
+        if (fprintf(output, "%s\n", line.c_str()) < 0) {
+            fprintf(stderr, "Error: could not write the Y4M header\n");
+            return false;
+        }
+    } else if (width < 1 || height < 1) {
+        fprintf(stderr, "Error: raw video needs the frame size\n");
+        return false;
+    } else if (options.format == VIDEO_YUV420) {
+        chroma_bytes = 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+    }
+    stats.width = width;
+    stats.height = height;
+
+    size_t pixels = (size_t)width * height;
+    bool rgb = options.format == VIDEO_RGB24;
+    std::vector<uint8_t> frame(rgb ? pixels * 3 : pixels + chroma_bytes);
+    std::vector<uint8_t> gray(rgb ? pixels : 0);
+    std::vector<uint8_t> filtered(pixels), sharpened(pixels);
+    incremental_pipeline incremental(options.incremental_tile, options.level);
+
+    for (;;) {
+        if (options.format == VIDEO_Y4M) {
+            if (!read_line(input, line)) {
+                break;
+            }
+            if (line.compare(0, 5, "FRAME") != 0) {
+                fprintf(stderr, "Error: expected a Y4M FRAME header after frame %d\n", stats.frames);
+                return false;
+            }
+        }
+        size_t got = fread(frame.data(), 1, frame.size(), input);
+        if (got == 0 && options.format != VIDEO_Y4M) {
+            break;
+        }
+        if (got != frame.size()) {
+            fprintf(stderr, "Error: frame %d is truncated\n", stats.frames);
+            return false;
+        }
+
+        double compute_start = profile_now_ms();
+        const uint8_t* result = sharpened.data();
+        if (options.incremental_tile > 0) {
+            incremental.run(frame.data(), rgb, width, height);
+            result = incremental.sharpened();
+            stats.tiles = incremental.total_tiles();
+            stats.dirty_tiles = incremental.total_dirty_tiles();
+        } else {
+            const uint8_t* luma = frame.data();
+            if (rgb) {
+                grayscale_simd(frame.data(), gray.data(), width, height, options.level);
+                luma = gray.data();
+            }
+            laplacian_simd(luma, filtered.data(), width, height, options.level);
+            sharpen_simd(luma, filtered.data(), sharpened.data(), width, height, options.level);
+        }
+        stats.compute_ms += profile_now_ms() - compute_start;
+
+        bool written = (options.format != VIDEO_Y4M || fputs("FRAME\n", output) >= 0) &&
+                       fwrite(result, 1, pixels, output) == pixels &&
+                       (rgb || fwrite(frame.data() + pixels, 1, chroma_bytes, output) == chroma_bytes);
+        if (!written) {
+            fprintf(stderr, "Error: could not write frame %d\n", stats.frames);
+            return false;
+        }
+        stats.frames++;
+    }
+
+    if (fflush(output) != 0) {
+        fprintf(stderr, "Error: could not write the output\n");
+        return false;
+    }
+    stats.total_ms = profile_now_ms() - start;
+    return true;
+}
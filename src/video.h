@@ -0,0 +1,43 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <stdio.h>
+#include "simd.h"
+
+// Y4M: YUV4MPEG2 with its own header (8-bit 4:2:0, 4:2:2, 4:4:4 or mono).
+// YUV420: headerless I420 frames. RGB24: headerless frames packed 3 bytes per
+// pixel, as the kernels take them.
+enum video_format { VIDEO_Y4M, VIDEO_YUV420, VIDEO_RGB24 };
+
+struct video_options {
+    video_format format;
+    int width, height;     // frame size of the raw formats; Y4M has it in its header
+    simd_level level;      // kernel implementation
+    int incremental_tile;  // > 0: recompute only changed tiles of this size (see incremental.h)
+
+    video_options() : format(VIDEO_Y4M), width(0), height(0), level(simd_best()), incremental_tile(0) {}
+};
+
+struct video_stats {
+    int frames;
+    int width, height;
+    double total_ms;          // whole stream, reads and writes included
+    double compute_ms;        // kernels only
+    long tiles, dirty_tiles;  // incremental mode: tiles seen and recomputed
+
+    video_stats() : frames(0), width(0), height(0), total_ms(0), compute_ms(0), tiles(0), dirty_tiles(0) {}
+    double fps() const { return total_ms > 0 ? frames * 1000.0 / total_ms : 0; }
+    double compute_fps() const { return compute_ms > 0 ? frames * 1000.0 / compute_ms : 0; }
+    double recomputed_fraction() const { return tiles ? (double)dirty_tiles / tiles : 0; }
+};
+
+// Sharpens a video stream frame by frame until input ends, reusing one set of
+// frame buffers throughout. For Y4M and YUV420 the Y plane goes straight into
+// the Laplacian and sharpen kernels, with no grayscale pass, and the output is
+// the same format with the sharpened Y plane and the chroma copied through.
+// RGB24 frames go through grayscale first and come out as 8-bit gray frames.
+// Returns false (with a message) on a bad header, a truncated frame or a
+// failed write.
+bool process_video(FILE* input, FILE* output, const video_options& options, video_stats& stats);
+
+#endif
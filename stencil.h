@@ -0,0 +1,118 @@
+#ifndef STENCIL_H
+#define STENCIL_H
+
+// Compile-time stencils. The coefficients are template arguments, and
+// apply() expands the K x K sum one tap at a time. A zero tap does not read
+// the window at all, a +-1 tap is an add or a subtract, a power-of-two tap is
+// a shift, and only the remaining taps multiply.
+
+namespace stencil_detail {
+
+constexpr bool is_pow2(int c) { return c > 0 && (c & (c - 1)) == 0; }
+constexpr int log2(int c) { return c <= 1 ? 0 : 1 + log2(c / 2); }
+constexpr int magnitude(int c) { return c < 0 ? -c : c; }
+
+// value * C for a non-negative value.
+template <int C, bool POW2 = is_pow2(magnitude(C))>
+struct scale {
+    static int apply(int value) {
+#pragma HLS INLINE
+        return value * C;
+    }
+};
+
+template <int C>
+struct scale<C, true> {
+    static int apply(int value) {
+#pragma HLS INLINE
+        return C < 0 ? -(value << log2(-C)) : value << log2(C);
+    }
+};
+
+// Contribution of one tap at row ky, column kx of the window.
+template <int C>
+struct tap {
+    template <typename window_t>
+    static int apply(const window_t& window, int ky, int kx) {
+#pragma HLS INLINE
+        return scale<C>::apply((int)window[ky][kx]);
+    }
+};
+
+template <>
+struct tap<0> {
+    template <typename window_t>
+    static int apply(const window_t&, int, int) {
+#pragma HLS INLINE
+        return 0;
+    }
+};
+
+template <int K, int I, int... C>
+struct taps;
+
+template <int K, int I>
+struct taps<K, I> {
+    template <typename window_t>
+    static int sum(const window_t&) {
+#pragma HLS INLINE
+        return 0;
+    }
+};
+
+template <int K, int I, int C, int... REST>
+struct taps<K, I, C, REST...> {
+    template <typename window_t>
+    static int sum(const window_t& window) {
+#pragma HLS INLINE
+        return tap<C>::apply(window, I / K, I % K) + taps<K, I + 1, REST...>::sum(window);
+    }
+};
+
+}
+
+// K x K stencil with its coefficients listed row by row.
+template <int K, int... C>
+struct stencil {
+    static_assert(K % 2 == 1 && sizeof...(C) == K * K, "a stencil needs K*K coefficients and an odd K");
+    static const int size = K;
+
+    // Weighted sum over window[0..K-1][0..K-1], centred on window[K/2][K/2].
+    template <typename window_t>
+    static int apply(const window_t& window) {
+#pragma HLS INLINE
+        return stencil_detail::taps<K, 0, C...>::sum(window);
+    }
+};
+
+// Laplacian over the 4 direct neighbours; what laplacian() uses.
+typedef stencil<3,
+                 0, -1,  0,
+                -1,  4, -1,
+                 0, -1,  0> laplacian4;
+
+// Laplacian over all 8 neighbours.
+typedef stencil<3,
+                -1, -1, -1,
+                -1,  8, -1,
+                -1, -1, -1> laplacian8;
+
+// 5x5 Laplacian of Gaussian.
+typedef stencil<5,
+                 0,  0, -1,  0,  0,
+                 0, -1, -2, -1,  0,
+                -1, -2, 16, -2, -1,
+                 0, -1, -2, -1,  0,
+                 0,  0, -1,  0,  0> laplacian_of_gaussian5;
+
+// Unsharp amount NUM / 2^SHIFT: sharpened = original + filtered * amount.
+// unsharp_amount<1> is what sharpen() does.
+template <int NUM, int SHIFT = 0>
+struct unsharp_amount {
+    static int apply(int original, int filtered) {
+#pragma HLS INLINE
+        return original + (stencil_detail::scale<NUM>::apply(filtered) >> SHIFT);
+    }
+};
+
+#endif